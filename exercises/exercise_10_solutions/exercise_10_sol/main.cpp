@@ -11,6 +11,13 @@
 
 #include "camera.h"
 
+#include <cerrno>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
 // glfw callbacks
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void button_input_callback(GLFWwindow* window, int button, int action, int mods);
@@ -26,9 +33,17 @@ const unsigned int SCR_HEIGHT = 800;
 
 Camera camera(glm::vec3(0.9f, 0.0f, 1.5f));
 rt::Renderer renderer;
+rt::Scene scene;
+// the BVHs of the meshes are stored in this directory, relative to the working directory the program is started from,
+// so that the next runs from there load them instead of building them
+const char *bvhCacheDirectory = "bvh_cache";
+rt::BVHCache bvhCache(bvhCacheDirectory);
 
 float deltaTime = 0;
 unsigned int rtDepth = 2;
+// how the frame is rendered, selected with the keyboard
+enum class RenderMode { OneSample, Progressive, Denoised, Budgeted, Checkerboard, Quarter, Hybrid };
+RenderMode renderMode = RenderMode::OneSample;
 
 int main()
 {
@@ -79,17 +94,19 @@ int main()
     Primitives::makeCube(2.f, points, normals, uvs, colors);
 
 
-    vector<rt::vertex> vts;
-    glm::mat4 scale = glm::scale(glm::vec3(.25f,.25f,.25f));
+    // each mesh is stored once, in its own object space, and placed in the scene by one or more instances
+    vector<rt::vertex> cube;
     for (unsigned int i = 0; i < points.size(); i++){
-        rt::vertex v{scale * glm::vec4(points[i], 1.0f),
+        rt::vertex v{glm::vec4(points[i], 1.0f),
                     glm::vec4(normals[i], 0),
                     colors[i],
                     uvs[i]
         };
-        vts.push_back(v);
+        cube.push_back(v);
     }
 
+    // the room is a cube turned inside-out, we keep the original normals so that they point inwards
+    vector<rt::vertex> room;
     glm::mat4 outsideout = glm::scale(glm::vec3(-2.f,-2.f,-2.f));
     for (unsigned int i = 0; i < points.size(); i++){
         rt::vertex v{outsideout * glm::vec4(points[i], 1.0f),
@@ -97,9 +114,27 @@ int main()
                      rt::grey,
                      uvs[i]
         };
-        vts.push_back(v);
+        room.push_back(v);
     }
 
+    // the cache only writes files to an existing directory, it's fine if it is already there
+#ifdef _WIN32
+    int mkdirResult = _mkdir(bvhCacheDirectory);
+#else
+    int mkdirResult = mkdir(bvhCacheDirectory, 0755);
+#endif
+    if (mkdirResult == 0 || errno == EEXIST)
+        scene.bvh_cache = &bvhCache;
+    else
+        std::cout << "Can't create the BVH cache directory " << bvhCacheDirectory << ", BVHs will be built every run" << std::endl;
+    unsigned int cubeMesh = scene.addMesh(cube);
+    unsigned int roomMesh = scene.addMesh(room);
+    scene.addInstance(cubeMesh, glm::scale(glm::vec3(.25f,.25f,.25f)));
+    scene.addInstance(roomMesh, glm::mat4(1));
+    // the meshes are static, so we can swap their BVHs for the smaller and faster 8-wide version
+    scene.compressMesh(cubeMesh);
+    scene.compressMesh(roomMesh);
+
 
 
     // initialize our custom frame buffer
@@ -139,6 +174,13 @@ int main()
     std::cout << "3 - two reflections" << std::endl;
     std::cout << "4 - three reflections" << std::endl;
     std::cout << "5 - four reflections" << std::endl;
+    std::cout << "P - progressive rendering (accumulate samples while the camera is still)" << std::endl;
+    std::cout << "N - two samples per pixel, denoised" << std::endl;
+    std::cout << "B - frame time budget (depth is a maximum, reflections refine while the camera is still)" << std::endl;
+    std::cout << "I - trace half of the pixels every frame (checkerboard), reuse the rest from the previous frame" << std::endl;
+    std::cout << "K - trace a quarter of the pixels every frame, reuse the rest from the previous frames" << std::endl;
+    std::cout << "H - rasterize the primary visibility, ray trace shadows and reflections" << std::endl;
+    std::cout << "O - one sample per pixel every frame" << std::endl;
 
     while (!glfwWindowShouldClose(window))
     {
@@ -152,9 +194,32 @@ int main()
         // ---------------------------------
         customBuffer.clearBuffer(rt::Colors::toRGBA32(rt::Colors::black));
 
-        glm::mat4 scale = glm::scale(glm::vec3(.5f,.5f,.5f));
-
-        renderer.render(vts, glm::mat4(1), camera.GetViewMatrix(), 70.0f, rtDepth, customBuffer);
+        // rebuilds the top level acceleration structure if any instance has moved
+        scene.update();
+
+        switch (renderMode) {
+            case RenderMode::Progressive:
+                renderer.renderProgressive(scene, camera.GetViewMatrix(), 70.0f, rtDepth, customBuffer);
+                break;
+            case RenderMode::Denoised:
+                renderer.renderDenoised(scene, camera.GetViewMatrix(), 70.0f, rtDepth, 2, customBuffer);
+                break;
+            case RenderMode::Budgeted:
+                // we leave part of the frame for uploading and displaying the image
+                renderer.renderBudgeted(scene, camera.GetViewMatrix(), 70.0f, rtDepth, loopInterval * 1000.0f * .75f, customBuffer);
+                break;
+            case RenderMode::Checkerboard:
+                renderer.renderInterleaved(scene, camera.GetViewMatrix(), 70.0f, rtDepth, 2, customBuffer);
+                break;
+            case RenderMode::Quarter:
+                renderer.renderInterleaved(scene, camera.GetViewMatrix(), 70.0f, rtDepth, 4, customBuffer);
+                break;
+            case RenderMode::Hybrid:
+                renderer.renderHybrid(scene, camera.GetViewMatrix(), 70.0f, rtDepth, customBuffer);
+                break;
+            default:
+                renderer.render(scene, camera.GetViewMatrix(), 70.0f, rtDepth, customBuffer);
+        }
 
         // show our rendered image
         // -----------------------
@@ -236,6 +301,15 @@ void processInput(GLFWwindow *window) {
     if (glfwGetKey(window, GLFW_KEY_4) == GLFW_PRESS) rtDepth = 4;
     if (glfwGetKey(window, GLFW_KEY_5) == GLFW_PRESS) rtDepth = 5;
 
+    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) renderMode = RenderMode::Progressive;
+    if (glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS) renderMode = RenderMode::Denoised;
+    if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS) renderMode = RenderMode::Budgeted;
+    if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS) renderMode = RenderMode::Checkerboard;
+    if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS) renderMode = RenderMode::Quarter;
+    if (glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS) renderMode = RenderMode::Hybrid;
+    if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS) renderMode = RenderMode::OneSample;
+
+
     // movement commands
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
         camera.ProcessKeyboard(FORWARD, deltaTime);
@@ -0,0 +1,244 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_BVH_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_BVH_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "rt_types.h"
+#include "rt_intersection.h"
+
+namespace rt{
+
+    // a node of the bounding volume hierarchy
+    // internal nodes have count == 0 and their two children stored at nodes[first] and nodes[first+1]
+    // leaves have count > 0 and reference the primitives indices[first] to indices[first + count - 1]
+    struct BVHNode{
+        AABB bounds;
+        uint32_t first = 0;
+        uint32_t count = 0;
+
+        bool isLeaf() const { return count > 0; }
+    };
+
+    // binary bounding volume hierarchy built with the surface area heuristic (SAH)
+    // the BVH only knows about the bounds of the primitives, the primitive intersection tests are passed to the
+    // traversal methods, so the same structure is used for triangles (bottom level) and for instances (top level)
+    class BVH{
+    public:
+        std::vector<BVHNode> nodes;
+        std::vector<uint32_t> indices; // primitives sorted so that each leaf references a contiguous range
+
+        // leaves are split until they have at most this many primitives (unless splitting is not possible)
+        unsigned int max_leaf_size = 4;
+
+        // deepest level of the tree (the root is level 0), nodes at this level are leaves whatever their size.
+        // The traversal stacks hold one node per level plus one, so they can't overflow on lopsided trees
+        static const unsigned int max_depth = 63;
+
+        void build(const std::vector<AABB> &primitive_bounds){
+            unsigned int count = primitive_bounds.size();
+            nodes.clear();
+            indices.resize(count);
+            for (unsigned int i = 0; i < count; i++) indices[i] = i;
+            if (count == 0) return;
+
+            std::vector<glm::vec3> centroids(count);
+            for (unsigned int i = 0; i < count; i++) centroids[i] = primitive_bounds[i].center();
+
+            nodes.reserve(2 * count - 1);
+            nodes.push_back(BVHNode());
+            nodes[0].first = 0;
+            nodes[0].count = count;
+            subdivide(0, primitive_bounds, centroids, 0);
+        }
+
+        AABB bounds() const {
+            return nodes.empty() ? AABB() : nodes[0].bounds;
+        }
+
+        // update the node bounds after the primitives have moved, keeping the tree topology
+        // this is O(N) and much cheaper than build, but the tree quality degrades if primitives move too much (see sahCost)
+        void refit(const std::vector<AABB> &primitive_bounds){
+            // children are always stored after their parent, so iterating backwards updates children before parents
+            for (int n = int(nodes.size()) - 1; n >= 0; n--) {
+                BVHNode &node = nodes[n];
+                node.bounds = AABB();
+                if (node.isLeaf()) {
+                    for (uint32_t i = node.first; i < node.first + node.count; i++)
+                        node.bounds.grow(primitive_bounds[indices[i]]);
+                }
+                else {
+                    node.bounds.grow(nodes[node.first].bounds);
+                    node.bounds.grow(nodes[node.first + 1].bounds);
+                }
+            }
+        }
+
+        // expected cost of tracing a ray through the tree (surface area heuristic), relative to the cost of one
+        // primitive intersection. It is normalized by the root area, so it can be compared before and after a refit
+        float sahCost() const {
+            if (nodes.empty() || nodes[0].bounds.surfaceArea() <= 0) return 0;
+            float cost = 0;
+            for (const BVHNode &node : nodes)
+                cost += node.bounds.surfaceArea() * (node.isLeaf() ? float(node.count) : 1.0f);
+            return cost / nodes[0].bounds.surfaceArea();
+        }
+
+        // closest hit traversal, children are visited front to back so that far nodes can be culled by tmax
+        // test(primitive, tmax) must return true and shrink tmax when it finds a hit closer than tmax
+        template <class PrimitiveTest>
+        bool intersect(const Ray &ray, float &tmax, PrimitiveTest test) const {
+            if (nodes.empty()) return false;
+            glm::vec3 inv_dir = safeInverse(ray.direction);
+            float t_entry;
+            if (!rayAABBIntersection(ray.origin, inv_dir, nodes[0].bounds, tmax, t_entry)) return false;
+
+            bool hit = false;
+            uint32_t stack[max_depth + 1];
+            float stack_t[max_depth + 1];
+            int top = 0;
+            stack[top] = 0; stack_t[top++] = t_entry;
+            while (top > 0) {
+                top--;
+                // this node may have been pushed before a closer hit was found
+                if (stack_t[top] > tmax) continue;
+                const BVHNode &node = nodes[stack[top]];
+
+                if (node.isLeaf()) {
+                    for (uint32_t i = node.first; i < node.first + node.count; i++)
+                        hit |= test(indices[i], tmax);
+                    continue;
+                }
+
+                float t_a, t_b;
+                bool hit_a = rayAABBIntersection(ray.origin, inv_dir, nodes[node.first].bounds, tmax, t_a);
+                bool hit_b = rayAABBIntersection(ray.origin, inv_dir, nodes[node.first + 1].bounds, tmax, t_b);
+                // push the far child first, so that the near child is popped (visited) first
+                if (hit_a && hit_b) {
+                    bool a_first = t_a <= t_b;
+                    stack[top] = node.first + (a_first ? 1 : 0); stack_t[top++] = a_first ? t_b : t_a;
+                    stack[top] = node.first + (a_first ? 0 : 1); stack_t[top++] = a_first ? t_a : t_b;
+                }
+                else if (hit_a) { stack[top] = node.first; stack_t[top++] = t_a; }
+                else if (hit_b) { stack[top] = node.first + 1; stack_t[top++] = t_b; }
+            }
+            return hit;
+        }
+
+        // any hit traversal, returns as soon as test(primitive, tmax) returns true
+        // the distance to the children does not matter here, instead we visit the child with the largest surface
+        // area first, since it is the one more likely to contain an occluder
+        template <class PrimitiveTest>
+        bool occluded(const Ray &ray, float tmax, PrimitiveTest test) const {
+            if (nodes.empty()) return false;
+            glm::vec3 inv_dir = safeInverse(ray.direction);
+            float t_entry;
+
+            uint32_t stack[max_depth + 1];
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0) {
+                const BVHNode &node = nodes[stack[--top]];
+                if (!rayAABBIntersection(ray.origin, inv_dir, node.bounds, tmax, t_entry)) continue;
+
+                if (node.isLeaf()) {
+                    for (uint32_t i = node.first; i < node.first + node.count; i++)
+                        if (test(indices[i], tmax)) return true;
+                    continue;
+                }
+
+                bool a_first = nodes[node.first].bounds.surfaceArea() >= nodes[node.first + 1].bounds.surfaceArea();
+                stack[top++] = node.first + (a_first ? 1 : 0);
+                stack[top++] = node.first + (a_first ? 0 : 1);
+            }
+            return false;
+        }
+
+    private:
+        // number of bins used to evaluate the SAH split candidates
+        static const int bin_count = 12;
+
+        void subdivide(uint32_t node_idx, const std::vector<AABB> &primitive_bounds, const std::vector<glm::vec3> &centroids,
+                       unsigned int depth){
+            BVHNode &node = nodes[node_idx];
+            AABB centroid_bounds;
+            node.bounds = AABB();
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                node.bounds.grow(primitive_bounds[indices[i]]);
+                centroid_bounds.grow(centroids[indices[i]]);
+            }
+            if (node.count <= 1 || depth >= max_depth) return;
+
+            // split along the axis with the largest centroid extent
+            glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+            int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+            uint32_t mid;
+
+            if (extent[axis] <= 0) {
+                // all centroids are at the same position, the SAH can't tell them apart
+                if (node.count <= max_leaf_size) return;
+                mid = node.first + node.count / 2;
+            }
+            else {
+                // bin the centroids and find the split plane with the smallest SAH cost
+                AABB bin_bounds[bin_count];
+                uint32_t bin_prims[bin_count] = {0};
+                float scale = bin_count / extent[axis];
+                for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                    int b = glm::min(bin_count - 1, int((centroids[indices[i]][axis] - centroid_bounds.min[axis]) * scale));
+                    bin_prims[b]++;
+                    bin_bounds[b].grow(primitive_bounds[indices[i]]);
+                }
+
+                float right_area[bin_count - 1];
+                uint32_t right_prims[bin_count - 1];
+                AABB acc; uint32_t acc_prims = 0;
+                for (int b = bin_count - 1; b > 0; b--) {
+                    acc.grow(bin_bounds[b]); acc_prims += bin_prims[b];
+                    right_area[b - 1] = acc.surfaceArea();
+                    right_prims[b - 1] = acc_prims;
+                }
+
+                float best_cost = FLT_MAX; int best_split = 0;
+                acc = AABB(); acc_prims = 0;
+                for (int b = 0; b < bin_count - 1; b++) {
+                    acc.grow(bin_bounds[b]); acc_prims += bin_prims[b];
+                    if (acc_prims == 0 || right_prims[b] == 0) continue;
+                    float cost = acc.surfaceArea() * acc_prims + right_area[b] * right_prims[b];
+                    if (cost < best_cost) { best_cost = cost; best_split = b; }
+                }
+
+                // a leaf costs one intersection per primitive, a split costs one traversal step plus the children
+                float leaf_cost = float(node.count);
+                float split_cost = 1.0f + best_cost / node.bounds.surfaceArea();
+                if (split_cost >= leaf_cost && node.count <= max_leaf_size) return;
+
+                // partition the primitive indices around the split plane
+                uint32_t *begin = &indices[node.first];
+                uint32_t *end = begin + node.count;
+                uint32_t *middle = std::partition(begin, end, [&](uint32_t p){
+                    int b = glm::min(bin_count - 1, int((centroids[p][axis] - centroid_bounds.min[axis]) * scale));
+                    return b <= best_split;
+                });
+                mid = node.first + uint32_t(middle - begin);
+            }
+
+            uint32_t first = node.first, count = node.count;
+            uint32_t child = nodes.size();
+            nodes.push_back(BVHNode());
+            nodes.push_back(BVHNode());
+            // nodes may have been reallocated, so we can't use the "node" reference anymore
+            nodes[node_idx].first = child;
+            nodes[node_idx].count = 0;
+            nodes[child].first = first;
+            nodes[child].count = mid - first;
+            nodes[child + 1].first = mid;
+            nodes[child + 1].count = first + count - mid;
+            subdivide(child, primitive_bounds, centroids, depth + 1);
+            subdivide(child + 1, primitive_bounds, centroids, depth + 1);
+        }
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_BVH_H
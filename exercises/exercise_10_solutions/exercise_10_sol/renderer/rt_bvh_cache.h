@@ -0,0 +1,183 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_BVH_CACHE_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_BVH_CACHE_H
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include "rt_types.h"
+#include "rt_bvh.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define RT_BVH_CACHE_MMAP
+#endif
+
+namespace rt{
+
+    // hash of the vertex positions of a mesh, the only data the BVH depends on (FNV-1a over 32 bit words)
+    inline uint64_t hashVertexPositions(const std::vector<vertex> &vts){
+        uint64_t hash = 14695981039346656037ull;
+        for (const vertex &v : vts){
+            uint32_t words[4];
+            std::memcpy(words, &v.pos, sizeof(words));
+            for (uint32_t w : words) hash = (hash ^ w) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // stores built BVHs on disk, one file per mesh named after the hash of its vertices, so that the next
+    // runs of the program can load them instead of building them again. It is only a cache: any file that
+    // doesn't match exactly what we expect is ignored (and overwritten by the next store)
+    class BVHCache{
+    public:
+        // files are written to this directory, it must exist
+        explicit BVHCache(const std::string &directory) : m_directory(directory) {}
+
+        // loads the BVH of a mesh with the given hash and number of triangles into bvh,
+        // returns false (and leaves bvh unchanged) if there is no valid file for it
+        bool load(uint64_t hash, unsigned int triangle_count, BVH &bvh) const {
+            std::vector<char> file_copy;
+            const char *data = nullptr;
+            size_t size = 0;
+
+#ifdef RT_BVH_CACHE_MMAP
+            // map the file instead of reading it, the pages we copy from are read straight from the OS file cache
+            int fd = open(fileName(hash).c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            void *mapped = MAP_FAILED;
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                size = size_t(st.st_size);
+                mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            }
+            close(fd);
+            if (mapped == MAP_FAILED) return false;
+            data = static_cast<const char*>(mapped);
+#else
+            std::ifstream file(fileName(hash), std::ios::binary | std::ios::ate);
+            if (!file) return false;
+            size = size_t(file.tellg());
+            file_copy.resize(size);
+            file.seekg(0);
+            if (!file.read(file_copy.data(), size)) return false;
+            data = file_copy.data();
+#endif
+
+            bool valid = parse(data, size, hash, triangle_count, bvh);
+
+#ifdef RT_BVH_CACHE_MMAP
+            munmap(mapped, size);
+#endif
+            return valid;
+        }
+
+        // writes the BVH of a mesh, returns false if the file could not be written
+        bool store(uint64_t hash, unsigned int triangle_count, const BVH &bvh) const {
+            Header header = makeHeader(hash, triangle_count, bvh);
+            header.node_count = bvh.nodes.size();
+            header.index_count = bvh.indices.size();
+
+            // we write to a temporary file and rename it, so a program that is loading the cache never sees a half written file
+            std::string name = fileName(hash), temp_name = name + ".tmp";
+            {
+                std::ofstream file(temp_name, std::ios::binary | std::ios::trunc);
+                if (!file) return false;
+                file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                file.write(reinterpret_cast<const char*>(bvh.nodes.data()), bvh.nodes.size() * sizeof(BVHNode));
+                file.write(reinterpret_cast<const char*>(bvh.indices.data()), bvh.indices.size() * sizeof(uint32_t));
+                if (!file) { file.close(); std::remove(temp_name.c_str()); return false; }
+            }
+            // rename doesn't replace existing files on every platform
+            std::remove(name.c_str());
+            if (std::rename(temp_name.c_str(), name.c_str()) != 0) { std::remove(temp_name.c_str()); return false; }
+            return true;
+        }
+
+    private:
+        // increase when the BVH build or the file layout change, old files are then ignored
+        static const uint32_t format_version = 2;
+
+        struct Header{
+            char magic[4];              // "RTBV"
+            uint32_t version;
+            uint32_t node_size;         // sizeof(BVHNode), guards against a different compiler/platform layout
+            uint32_t max_leaf_size;
+            uint64_t hash;
+            uint32_t triangle_count;
+            uint32_t node_count;
+            uint32_t index_count;
+            uint32_t padding;
+        };
+
+        std::string m_directory;
+
+        std::string fileName(uint64_t hash) const {
+            char name[32];
+            std::snprintf(name, sizeof(name), "%016llx.rtbvh", (unsigned long long) hash);
+            return m_directory + "/" + name;
+        }
+
+        static Header makeHeader(uint64_t hash, unsigned int triangle_count, const BVH &bvh){
+            Header header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, "RTBV", 4);
+            header.version = format_version;
+            header.node_size = sizeof(BVHNode);
+            header.max_leaf_size = bvh.max_leaf_size;
+            header.hash = hash;
+            header.triangle_count = triangle_count;
+            return header;
+        }
+
+        static bool parse(const char *data, size_t size, uint64_t hash, unsigned int triangle_count, BVH &bvh){
+            if (size < sizeof(Header)) return false;
+            Header header;
+            std::memcpy(&header, data, sizeof(header));
+
+            // everything but the counts must be what we would write ourselves
+            Header expected = makeHeader(hash, triangle_count, bvh);
+            expected.node_count = header.node_count;
+            expected.index_count = header.index_count;
+            expected.padding = header.padding;
+            if (std::memcmp(&header, &expected, sizeof(Header)) != 0) return false;
+            if (header.index_count != triangle_count) return false;
+            if (size != sizeof(Header) + size_t(header.node_count) * sizeof(BVHNode) + size_t(header.index_count) * sizeof(uint32_t))
+                return false;
+
+            std::vector<BVHNode> nodes(header.node_count);
+            std::vector<uint32_t> indices(header.index_count);
+            const char *nodes_data = data + sizeof(Header);
+            std::memcpy(nodes.data(), nodes_data, nodes.size() * sizeof(BVHNode));
+            std::memcpy(indices.data(), nodes_data + nodes.size() * sizeof(BVHNode), indices.size() * sizeof(uint32_t));
+
+            // a corrupted file must not make traversal read out of bounds, so we check every reference, and that the
+            // tree is not deeper than the traversal stacks allow (children are stored after their parents, so the
+            // depth of a node is known when we reach it)
+            for (uint32_t i : indices)
+                if (i >= triangle_count) return false;
+            std::vector<uint8_t> depth(nodes.size(), 0);
+            for (uint32_t n = 0; n < nodes.size(); n++) {
+                const BVHNode &node = nodes[n];
+                if (node.isLeaf() ? uint64_t(node.first) + node.count > indices.size()
+                                  : node.first <= n || uint64_t(node.first) + 1 >= nodes.size() || depth[n] >= BVH::max_depth)
+                    return false;
+                if (!node.isLeaf()) {
+                    depth[node.first] = std::max(depth[node.first], uint8_t(depth[n] + 1));
+                    depth[node.first + 1] = std::max(depth[node.first + 1], uint8_t(depth[n] + 1));
+                }
+            }
+
+            bvh.nodes.swap(nodes);
+            bvh.indices.swap(indices);
+            return true;
+        }
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_BVH_CACHE_H
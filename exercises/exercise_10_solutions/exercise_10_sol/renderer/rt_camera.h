@@ -0,0 +1,59 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_CAMERA_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_CAMERA_H
+
+#include <glm/glm.hpp>
+#include "rt_types.h"
+
+namespace rt{
+    using namespace glm;
+
+    // the information required to generate the primary rays of a frame, it is computed once per frame
+    struct CameraRays{
+        CameraRays(const glm::mat4 &v, const float fov_degrees, unsigned int W, unsigned int H){
+            float aspect_ratio = H / W;
+            // we use the fov and the tangent function to compute where is the bottom of the projection plane,
+            // we assume that the projection place is 1 unit in front of the camera (z == -1)
+            float bottom = - tan(abs(radians(fov_degrees)) * 0.5f);
+
+            // find the transformation that move points from camera space to world space
+            world_to_view = v;
+            view_to_world = inverse(v);
+            // the bottom left corner of the image plane/camera sensor
+            lower_left_corner = vec4(bottom * aspect_ratio, bottom, -1, 1);
+            // we transform the camera position (also the convergence point of light rays) from camera coordinates to WORLD coordinates
+            // notice that we implicitly assume that the camera position is at 0,0,0 in its one coordinate space
+            // rays are moved from world space to the space of each object by the scene, during traversal
+            cam_pos = view_to_world * vec4(0,0,0,1);
+
+            // the distance from the center of one pixel to the next along the horizontal and vertical axes of the screen
+            // notice that * and / are applied component wise
+            pixel_size = abs(vec2(lower_left_corner)) * 2.0f / vec2(H, W);
+        }
+
+        // ray through the image plane position (x, y), in pixel units, integer values are the pixel locations
+        Ray rayAt(float x, float y) const {
+            vec4 pixel_pos = lower_left_corner + vec4 (vec2(x, y) * pixel_size,0, 0);
+            pixel_pos = view_to_world * pixel_pos;  // transform from camera coord space to world coord space
+            return Ray(cam_pos, normalize(pixel_pos - cam_pos));
+        }
+
+        // the opposite of rayAt, image plane position (in pixel units) of a world space point and its distance
+        // to the camera, returns false if the point is behind the camera
+        bool project(const vec3 &world_pos, vec2 &pixel, float &dist) const {
+            vec4 p_cam = world_to_view * vec4(world_pos, 1);
+            if (p_cam.z >= 0) return false;
+            vec2 on_plane = vec2(p_cam) / -p_cam.z; // the image plane is at z == -1
+            pixel = (on_plane - vec2(lower_left_corner)) / pixel_size;
+            dist = length(world_pos - vec3(cam_pos));
+            return true;
+        }
+
+        mat4 world_to_view;
+        mat4 view_to_world;
+        vec4 lower_left_corner;
+        vec4 cam_pos;
+        vec2 pixel_size;
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_CAMERA_H
@@ -0,0 +1,110 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_DENOISER_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_DENOISER_H
+
+#include <vector>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "rt_types.h"
+#include "rt_parallel.h"
+
+namespace rt{
+    using namespace Colors;
+
+    // properties of the first surface seen through a pixel, written by Renderer::traceRay for the primary ray
+    struct SurfaceSample{
+        glm::vec3 normal = glm::vec3(0);   // world space shading normal, (0,0,0) if the ray missed
+        float depth = FLT_MAX;             // distance from the camera
+        glm::vec3 albedo = glm::vec3(0);   // surface color, without lighting
+    };
+
+    // one surface sample per pixel, same layout as the FrameBuffer (x + y * W)
+    struct GBuffer{
+        unsigned int W = 0, H = 0;
+        std::vector<SurfaceSample> samples;
+
+        void resize(unsigned int width, unsigned int height){
+            W = width; H = height;
+            samples.assign(W * H, SurfaceSample());
+        }
+
+        SurfaceSample &at(unsigned int x, unsigned int y) { return samples[x + y * W]; }
+        const SurfaceSample &at(unsigned int x, unsigned int y) const { return samples[x + y * W]; }
+    };
+
+    // edge-avoiding à-trous wavelet filter (Dammertz et al. 2010)
+    // every iteration blurs the image with a 5x5 B3-spline kernel whose taps are spread 2^i pixels apart,
+    // so a few iterations cover a large footprint with only 25 taps each. Taps are weighted down when their
+    // color, normal, depth or albedo differ from the center pixel, which keeps geometric and texture edges sharp
+    class Denoiser{
+    public:
+        unsigned int iterations = 3;
+        // the larger a sigma, the more a difference in the respective buffer is tolerated
+        float sigma_color = 0.1f;   // halved every iteration, the image gets smoother as we go
+        float sigma_normal = 64.0f; // exponent of the normal similarity, larger is stricter
+        float sigma_depth = 0.05f;  // relative to the depth of the center pixel and to the tap distance
+        float sigma_albedo = 0.1f;
+
+        // filters W * H colors in 'in' guided by 'g', the result is written to 'out' (it can be the same as 'in')
+        void filter(const std::vector<color> &in, const GBuffer &g, std::vector<color> &out){
+            m_ping = in;
+            m_pong.resize(in.size());
+
+            float sigma_c = sigma_color;
+            for (unsigned int it = 0; it < iterations; it++){
+                int step = 1 << it;
+                // rows are independent of each other, we filter them in parallel
+                parallelFor(0, g.H, [&](unsigned int y){
+                    for (unsigned int x = 0; x < g.W; x++)
+                        m_pong[x + y * g.W] = filterPixel(x, y, step, sigma_c, g);
+                });
+                std::swap(m_ping, m_pong);
+                sigma_c *= 0.5f;
+            }
+            out.swap(m_ping);
+        }
+
+    private:
+        std::vector<color> m_ping, m_pong;
+
+        color filterPixel(int x, int y, int step, float sigma_c, const GBuffer &g) const {
+            static const float kernel[5] = {1.0f/16, 1.0f/4, 3.0f/8, 1.0f/4, 1.0f/16};
+
+            const color &c_p = m_ping[x + y * g.W];
+            const SurfaceSample &s_p = g.at(x, y);
+            // pixels that see the background have nothing to be smoothed with
+            if (s_p.depth == FLT_MAX) return c_p;
+
+            color sum(0);
+            float weight_sum = 0;
+            for (int j = -2; j <= 2; j++){
+                int qy = y + j * step;
+                if (qy < 0 || qy >= int(g.H)) continue;
+                for (int i = -2; i <= 2; i++){
+                    int qx = x + i * step;
+                    if (qx < 0 || qx >= int(g.W)) continue;
+
+                    const color &c_q = m_ping[qx + qy * g.W];
+                    const SurfaceSample &s_q = g.at(qx, qy);
+                    if (s_q.depth == FLT_MAX) continue;
+
+                    glm::vec3 dc = glm::vec3(c_p - c_q);
+                    glm::vec3 da = s_p.albedo - s_q.albedo;
+                    float w_color = std::exp(-glm::dot(dc, dc) / (sigma_c * sigma_c));
+                    float w_normal = std::pow(std::max(glm::dot(s_p.normal, s_q.normal), 0.0f), sigma_normal);
+                    float w_depth = std::exp(-std::abs(s_p.depth - s_q.depth) / (sigma_depth * s_p.depth * float(step) + 1e-6f));
+                    float w_albedo = std::exp(-glm::dot(da, da) / (sigma_albedo * sigma_albedo));
+
+                    float w = kernel[i + 2] * kernel[j + 2] * w_color * w_normal * w_depth * w_albedo;
+                    sum += c_q * w;
+                    weight_sum += w;
+                }
+            }
+            // the center tap always has weight > 0, so weight_sum can't be 0
+            return sum / weight_sum;
+        }
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_DENOISER_H
@@ -0,0 +1,134 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_INTERSECTION_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_INTERSECTION_H
+
+#include <cmath>
+#include <glm/glm.hpp>
+#include "rt_types.h"
+
+namespace rt{
+
+    // axis aligned bounding box
+    struct AABB{
+        glm::vec3 min = glm::vec3(FLT_MAX);
+        glm::vec3 max = glm::vec3(-FLT_MAX);
+
+        void grow(const glm::vec3 &p) { min = glm::min(min, p); max = glm::max(max, p); }
+        void grow(const AABB &b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+        glm::vec3 center() const { return (min + max) * 0.5f; }
+        bool valid() const { return min.x <= max.x; }
+
+        float surfaceArea() const {
+            if (!valid()) return 0;
+            glm::vec3 d = max - min;
+            return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+        }
+
+        // bounds of this box after transforming it with the matrix m
+        AABB transformed(const glm::mat4 &m) const {
+            AABB out;
+            for (int i = 0; i < 8; i++) {
+                glm::vec3 corner((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z);
+                out.grow(glm::vec3(m * glm::vec4(corner, 1)));
+            }
+            return out;
+        }
+    };
+
+    // returns false if no intersection
+    // Möller–Trumbore ray/triangle intersection, t is the distance along the ray direction (in ray direction units)
+    inline bool rayTriangleIntersection(const Ray & ray,
+                                        const vertex & p1,
+                                        const vertex & p2,
+                                        const vertex & p3,
+                                        float & t, glm::vec3 & barycentric)
+    {
+        using namespace glm;
+        vec3 e1 = p2.pos - p1.pos;
+        vec3 e2 = p3.pos - p1.pos;
+        vec3 q = cross(ray.direction, e2);
+        float a = dot(e1, q);
+
+        float tolerance = 10e-7f;
+        // for numerical stability, a = 0 means that triangle plane and ray are parallel
+        if (abs(a) < tolerance) return false;
+
+        float f = 1.0f / a;
+        vec3 s = ray.origin - vec3(p1.pos);
+        float u = f * dot(s, q);
+
+        // if u < 0, intersection with plane is not within the triangle
+        if (u < -tolerance) return false;
+
+        vec3 r = cross(s, e1);
+        float v = f * dot(ray.direction, r);
+
+        // if v < 0 or u+v > 1, intersection with plane is not within the triangle
+        if (v < -tolerance || u + v > 1) return false;
+
+        t = f * dot(e2, r);
+
+        if (t < 0)
+            return false;
+
+        barycentric = vec3(1.0f - u - v, u, v);
+
+        return true;
+    }
+
+    // same test as rayTriangleIntersection, but we only want to know if the triangle is hit within [0, tmax]
+    // so we skip the barycentric coordinates and reject as soon as the distance is known to be out of range.
+    // tmax is included, like the closest hit test shadow rays used before (occluded if hit.dist <= light distance)
+    inline bool rayTriangleOcclusion(const Ray & ray,
+                                     const vertex & p1,
+                                     const vertex & p2,
+                                     const vertex & p3,
+                                     float tmax)
+    {
+        using namespace glm;
+        vec3 e1 = p2.pos - p1.pos;
+        vec3 e2 = p3.pos - p1.pos;
+        vec3 q = cross(ray.direction, e2);
+        float a = dot(e1, q);
+
+        float tolerance = 10e-7f;
+        if (abs(a) < tolerance) return false;
+
+        float f = 1.0f / a;
+        vec3 s = ray.origin - vec3(p1.pos);
+        float u = f * dot(s, q);
+        if (u < -tolerance) return false;
+
+        vec3 r = cross(s, e1);
+        float v = f * dot(ray.direction, r);
+        if (v < -tolerance || u + v > 1) return false;
+
+        float t = f * dot(e2, r);
+        return t >= 0 && t <= tmax;
+    }
+
+    // 1 / direction, with zero components replaced by a large finite value
+    // infinity would be fine for the slab tests, but 0 * infinity (e.g. a box plane at the ray origin) is NaN
+    inline glm::vec3 safeInverse(const glm::vec3 &direction)
+    {
+        glm::vec3 inv;
+        for (int a = 0; a < 3; a++)
+            inv[a] = std::abs(direction[a]) > 1e-20f ? 1.0f / direction[a] : std::copysign(1e20f, direction[a]);
+        return inv;
+    }
+
+    // slab test, inv_dir is 1 / ray direction (computed once per ray, see safeInverse)
+    // returns false if the box is missed or if it is entered after tmax, t_entry is where the ray enters the box
+    inline bool rayAABBIntersection(const glm::vec3 &origin, const glm::vec3 &inv_dir, const AABB &box,
+                                    float tmax, float &t_entry)
+    {
+        glm::vec3 t0 = (box.min - origin) * inv_dir;
+        glm::vec3 t1 = (box.max - origin) * inv_dir;
+        glm::vec3 t_near = glm::min(t0, t1);
+        glm::vec3 t_far = glm::max(t0, t1);
+        t_entry = glm::max(glm::max(t_near.x, t_near.y), glm::max(t_near.z, 0.0f));
+        float t_exit = glm::min(glm::min(t_far.x, t_far.y), glm::min(t_far.z, tmax));
+        return t_entry <= t_exit;
+    }
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_INTERSECTION_H
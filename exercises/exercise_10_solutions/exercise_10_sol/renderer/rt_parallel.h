@@ -0,0 +1,41 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_PARALLEL_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_PARALLEL_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+namespace rt{
+
+    // number of threads used by parallelFor, at least 1
+    inline unsigned int workerCount(){
+        unsigned int n = std::thread::hardware_concurrency();
+        return n == 0 ? 1 : n;
+    }
+
+    // calls fn(i) for every i in [begin, end) using all the cores, it returns once every call is done.
+    // indices are handed out in small batches from a shared counter, so that expensive rows (e.g. with many
+    // reflections) don't leave the other threads waiting. fn must be safe to call from several threads at once
+    template<class F>
+    void parallelFor(unsigned int begin, unsigned int end, const F &fn, unsigned int batch = 1){
+        if (begin >= end) return;
+        unsigned int thread_count = std::min(workerCount(), (end - begin + batch - 1) / batch);
+
+        std::atomic<unsigned int> next(begin);
+        auto worker = [&](){
+            for (unsigned int first = next.fetch_add(batch); first < end; first = next.fetch_add(batch)) {
+                unsigned int last = std::min(first + batch, end);
+                for (unsigned int i = first; i < last; i++) fn(i);
+            }
+        };
+
+        // the calling thread also does its share of the work
+        std::vector<std::thread> threads;
+        for (unsigned int t = 1; t < thread_count; t++) threads.emplace_back(worker);
+        worker();
+        for (std::thread &t : threads) t.join();
+    }
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_PARALLEL_H
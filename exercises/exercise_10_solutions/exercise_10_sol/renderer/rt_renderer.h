@@ -6,15 +6,64 @@
 #define ITU_GRAPHICS_PROGRAMMING_RT_RENDERER_H
 
 #include <vector>
+#include <chrono>
+#include <algorithm>
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include "rt_types.h"
+#include "rt_scene.h"
+#include "rt_camera.h"
+#include "rt_visibility.h"
+#include "rt_denoiser.h"
+#include "rt_parallel.h"
 #include "frame_buffer.h"
 
 namespace rt{
     using namespace Colors;
     using namespace glm;
 
+    // randomly stops reflection paths, the reflections that survive are weighted up by 1 / survival so that,
+    // on average, the color is the same as tracing every reflection (only noisier)
+    struct RussianRoulette{
+        RussianRoulette(float survival_probability, uint32_t seed): survival(survival_probability), state(seed){}
+        float survival;
+        uint32_t state;
+
+        // random number in [0, 1), every path has its own state so that threads don't share anything
+        float next01(){
+            state = state * 1664525u + 1013904223u;
+            uint32_t h = state;
+            h ^= h >> 16; h *= 0x7FEB352Du;
+            h ^= h >> 15;
+            return (h >> 8) * (1.0f / 16777216.0f);
+        }
+    };
+
+    // the parameters that produced a set of accumulated samples, if any of them changes the samples are discarded
+    struct FrameKey{
+        unsigned int scene_version = 0;
+        mat4 view = mat4(0);
+        float fov = 0;
+        unsigned int depth = 0;
+        unsigned int size = 0;
+        vec3 light = vec3(0);
+
+        bool operator==(const FrameKey &other) const {
+            return scene_version == other.scene_version && view == other.view && fov == other.fov &&
+                   depth == other.depth && size == other.size && light == other.light;
+        }
+        bool operator!=(const FrameKey &other) const { return !(*this == other); }
+    };
+
+    // a pixel of an interleaved frame, kept as history for the next frame
+    struct PixelHistory{
+        color col = black;
+        float dist = FLT_MAX;   // distance from the camera to the first hit, FLT_MAX if the ray missed
+        unsigned int age = 0;   // frames since the pixel was traced, not_traced if it couldn't be reprojected
+
+        static const unsigned int not_traced = ~0u;
+    };
+
     class Renderer{
         // limits the number of reflections, 1 == no reflection
         const unsigned int max_recursion = 5;
@@ -22,30 +71,36 @@ namespace rt{
         float p_rg = 0.4f;
 
     public:
-        void render(const std::vector<vertex> &vts,
-                    const glm::mat4 &m,
+        // progressive rendering parameters
+        // samples every pixel receives before we decide if it has converged
+        unsigned int min_samples = 4;
+        // pixels stop receiving rays once they reach this number of samples
+        unsigned int max_samples = 256;
+        // a pixel has converged when the standard error of its mean luminance is below this value
+        float convergence_error = 0.002f;
+
+        // point light, in world space
+        vec3 light_pos = vec3(0, 1.9f, 0);
+
+        // edge-aware filter applied by renderDenoised
+        Denoiser denoiser;
+
+        // interleaved rendering parameters
+        // reprojected pixels are discarded if their distance is out of the range of their traced neighbours by more than this fraction
+        float reprojection_tolerance = 0.1f;
+
+        // budgeted rendering parameters
+        // probability that a reflection is traced in the first refinement pass of renderBudgeted, later passes trace all of them
+        float roulette_survival = 0.5f;
+
+        // the scene must be up to date (see Scene::update)
+        void render(const Scene &scene,
                     const glm::mat4 &v,
                     const float fov_degrees,
                     unsigned int depth,
                     FrameBuffer <uint32_t> &fb) {
 
-            float aspect_ratio = fb.H / fb.W;
-            // we use the fov and the tangent function to compute where is the bottom of the projection plane,
-            // we assume that the projection place is 1 unit in front of the camera (z == -1)
-            float bottom = - tan(abs(radians(fov_degrees)) * 0.5f);
-
-            // find the transformation that move points from camera space to model space
-            mat4 view_to_model = inverse(v * m);
-            // the bottom left corner of the image plane/camera sensor
-            vec4 lower_left_corner = vec4(bottom * aspect_ratio, bottom, -1, 1);
-            // we transform the camera position (also the convergence point of light rays) from camera coordinates to MODEL coordinates
-            // notice that we implicitly assume that the camera position is at 0,0,0 in its one coordinate space
-            vec4 cam_pos = view_to_model * vec4(0,0,0,1);
-
-            // the distance from the center of one pixel to the next along the horizontal and vertical axes of the screen
-            // notice that * and / are applied component wise
-            vec2 pixel_size = abs(vec2(lower_left_corner)) * 2.0f / vec2(fb.H, fb.W);
-
+            CameraRays camera(v, fov_degrees, fb.W, fb.H);
 
             // TODO ex 10.1 iterate through all pixels in the buffer (width: [0, fb.W), height:[0, fb.H])
             //  for each pixel,
@@ -58,38 +113,302 @@ namespace rt{
             //  - call the TraceRay method using that ray, and store the resulting color in the frame buffer (fb)
             for (int c = 0; c < fb.W; c++){
                 for(int r = 0; r < fb.H; r++){
-                    vec4 pixel_pos = lower_left_corner + vec4 (vec2(c, r) * pixel_size,0, 0);
-                    pixel_pos = view_to_model * pixel_pos;  // transform from camera coord space to model coord space
-                    Ray ray(cam_pos, normalize(pixel_pos - cam_pos));
-                    color col = traceRay(ray, depth, vts);  // trace te ray / compute the color
+                    Ray ray = camera.rayAt(c, r);
+                    color col = traceRay(ray, depth, scene);  // trace te ray / compute the color
                     fb.paintAt(c, r, toRGBA32(col));        // set the color on the frame buffer
                 }
             }
 
         }
 
+        // same as render, but samples are accumulated over frames while the camera, the scene and the
+        // recursion depth don't change. Every call adds one jittered sample to the pixels that have not converged,
+        // so a static view is progressively anti-aliased, and pixels with no variation (most of them) stop tracing rays
+        void renderProgressive(const Scene &scene,
+                               const glm::mat4 &v,
+                               const float fov_degrees,
+                               unsigned int depth,
+                               FrameBuffer <uint32_t> &fb) {
+
+            FrameKey key{scene.version(), v, fov_degrees, depth, fb.W * fb.H, light_pos};
+            if (key != m_progressiveKey)
+                resetAccumulation(key);
+
+            CameraRays camera(v, fov_degrees, fb.W, fb.H);
+
+            for (int c = 0; c < fb.W; c++){
+                for(int r = 0; r < fb.H; r++){
+                    unsigned int i = c + r * fb.W;
+                    unsigned int n = m_samples[i];
+
+                    if (n < max_samples && !converged(i)) {
+                        // the first sample goes through the pixel location, so that the first frame matches render()
+                        vec2 jitter = pixelJitter(i, n);
+                        color col = traceRay(camera.rayAt(c + jitter.x, r + jitter.y), depth, scene);
+                        float lum = luminance(col);
+                        m_accum[i] += col;
+                        m_lumSum[i] += lum;
+                        m_lumSqSum[i] += lum * lum;
+                        m_samples[i] = ++n;
+                    }
+                    fb.paintAt(c, r, toRGBA32(m_accum[i] / float(n)));
+                }
+            }
+        }
+
+        // traces a few samples per pixel (in parallel) and cleans the result with the edge-aware denoiser,
+        // the first hit of the central sample of each pixel guides the filter.
+        // 1 or 2 samples per pixel denoised are comparable to many more samples without it
+        void renderDenoised(const Scene &scene,
+                            const glm::mat4 &v,
+                            const float fov_degrees,
+                            unsigned int depth,
+                            unsigned int samples_per_pixel,
+                            FrameBuffer <uint32_t> &fb) {
+
+            CameraRays camera(v, fov_degrees, fb.W, fb.H);
+            samples_per_pixel = samples_per_pixel == 0 ? 1 : samples_per_pixel;
+            m_gbuffer.resize(fb.W, fb.H);
+            m_noisy.resize(fb.W * fb.H);
+
+            parallelFor(0, fb.H, [&](unsigned int r){
+                for (unsigned int c = 0; c < fb.W; c++){
+                    unsigned int i = c + r * fb.W;
+                    color col = traceRay(camera.rayAt(c, r), depth, scene, &m_gbuffer.samples[i]);
+                    for (unsigned int n = 1; n < samples_per_pixel; n++) {
+                        vec2 jitter = pixelJitter(i, n);
+                        col += traceRay(camera.rayAt(c + jitter.x, r + jitter.y), depth, scene);
+                    }
+                    m_noisy[i] = col / float(samples_per_pixel);
+                }
+            });
+
+            denoiser.filter(m_noisy, m_gbuffer, m_noisy);
+
+            for (unsigned int i = 0; i < fb.W * fb.H; i++)
+                fb.buffer[i] = toRGBA32(m_noisy[i]);
+        }
+
+        // renders within a time budget (in milliseconds), whatever the recursion depth and the number of cores.
+        // When the view changes, a preview of the whole image is traced at the deepest recursion that the running cost
+        // estimate says fits in the budget. The time that is left, in this frame and in the next ones while the view
+        // doesn't change, adds samples with all max_depth reflections (and russian roulette) to the pixels in
+        // scanline order, so reflections refine over a few frames
+        void renderBudgeted(const Scene &scene,
+                            const glm::mat4 &v,
+                            const float fov_degrees,
+                            unsigned int max_depth,
+                            float budget_ms,
+                            FrameBuffer <uint32_t> &fb) {
+            typedef std::chrono::steady_clock clock;
+            const clock::time_point start = clock::now();
+            auto elapsed = [&start](){ return std::chrono::duration<float>(clock::now() - start).count(); };
+            const float budget = budget_ms * 0.001f;
+
+            max_depth = std::min(std::max(max_depth, 1u), max_recursion);
+            unsigned int size = fb.W * fb.H;
+            CameraRays camera(v, fov_degrees, fb.W, fb.H);
+
+            FrameKey key{scene.version(), v, fov_degrees, max_depth, size, light_pos};
+            if (key != m_budgetKey) {
+                m_budgetKey = key;
+                m_budgetAccum.assign(size, color(0));
+                m_budgetSamples.assign(size, 0);
+                m_budgetPreview.resize(size);
+                m_budgetCursor = 0;
+
+                // preview of the whole image, if even depth 1 doesn't fit in the budget we trace one pixel out of every
+                // stride x stride block and copy it to the rest of the block
+                m_previewStride = 1;
+                while (m_previewStride < 8 && estimatedCost(1) * size > budget * m_previewStride * m_previewStride)
+                    m_previewStride *= 2;
+                unsigned int stride = m_previewStride;
+                unsigned int cols = (fb.W + stride - 1) / stride, rows = (fb.H + stride - 1) / stride;
+                m_previewDepth = chooseDepth(max_depth, budget / float(cols * rows));
+
+                float preview_start = elapsed();
+                parallelFor(0, rows, [&](unsigned int br){
+                    for (unsigned int bc = 0; bc < cols; bc++) {
+                        color col = traceRay(camera.rayAt(bc * stride, br * stride), m_previewDepth, scene);
+                        for (unsigned int r = br * stride; r < std::min((br + 1) * stride, fb.H); r++)
+                            for (unsigned int c = bc * stride; c < std::min((bc + 1) * stride, fb.W); c++)
+                                m_budgetPreview[c + r * fb.W] = col;
+                    }
+                });
+                updateCost(m_depthCost[m_previewDepth], (elapsed() - preview_start) / float(cols * rows));
+            }
+
+            // refinement, the cursor counts the full depth samples traced since the view changed
+            const unsigned int total = size * max_samples;
+            while (m_budgetCursor < total) {
+                float remaining = budget - elapsed();
+                // the number of samples we expect to finish in the time that is left. We only plan half of it,
+                // the estimate is an average and we check the clock again afterwards
+                unsigned int count = m_refineCost > 0 ? unsigned(0.5f * remaining / m_refineCost) : fb.W;
+                if (remaining <= 0 || count == 0) break;
+                // a batch never wraps around the image, so every pixel gets at most one sample per batch
+                unsigned int first = m_budgetCursor;
+                count = std::min(count, std::min(size - first % size, total - first));
+
+                float refine_start = elapsed();
+                parallelFor(first, first + count, [&](unsigned int s){
+                    unsigned int i = s % size, n = s / size;
+                    // the first pass traces through the pixel location, later ones are jittered for anti-aliasing
+                    vec2 jitter = pixelJitter(i, n);
+                    RussianRoulette rr(n == 0 ? roulette_survival : 1.0f, i * 0x9E3779B1u + n);
+                    m_budgetAccum[i] += traceRay(camera.rayAt(i % fb.W + jitter.x, i / fb.W + jitter.y), max_depth, scene, nullptr, &rr);
+                    m_budgetSamples[i]++;
+                }, 16);
+                updateCost(m_refineCost, (elapsed() - refine_start) / float(count));
+                m_budgetCursor += count;
+            }
+
+            // pixels that have no full depth sample yet show the preview
+            for (unsigned int i = 0; i < size; i++)
+                fb.buffer[i] = toRGBA32(m_budgetSamples[i] ? m_budgetAccum[i] / float(m_budgetSamples[i]) : m_budgetPreview[i]);
+        }
+
+        // recursion depth and pixel stride of the last preview traced by renderBudgeted
+        unsigned int previewDepth() const { return m_previewDepth; }
+        unsigned int previewStride() const { return m_previewStride; }
+
+        // traces only part of the pixels every frame, pattern 2 is a checkerboard and pattern 4 is one pixel of
+        // every 2x2 block, the traced pixels change every frame. The other pixels reuse the previous frame: the
+        // world position each pixel saw is found with the previous view and projected with the current one.
+        // Where that is not possible (disocclusion, the camera moved too much) the pixel is interpolated from its
+        // traced neighbours. The whole image is traced when the scene, the depth or the size of the image change
+        void renderInterleaved(const Scene &scene,
+                               const glm::mat4 &v,
+                               const float fov_degrees,
+                               unsigned int depth,
+                               unsigned int pattern,
+                               FrameBuffer <uint32_t> &fb) {
+
+            unsigned int size = fb.W * fb.H;
+            pattern = pattern >= 4 ? 4 : (pattern >= 2 ? 2 : 1);
+            CameraRays camera(v, fov_degrees, fb.W, fb.H);
+
+            // the view is not part of the key, camera motion is handled by the reprojection
+            FrameKey key{scene.version(), mat4(1), 0, depth, size, light_pos};
+            bool reuse = key == m_interleavedKey && pattern > 1;
+            m_interleavedKey = key;
+            m_current.resize(size);
+
+            unsigned int phase = m_interleavedFrame++ % pattern;
+            parallelFor(0, fb.H, [&](unsigned int r){
+                for (unsigned int c = 0; c < fb.W; c++) {
+                    PixelHistory &px = m_current[c + r * fb.W];
+                    if (!reuse || isTraced(c, r, phase, pattern)) {
+                        SurfaceSample first_hit;
+                        px.col = traceRay(camera.rayAt(c, r), depth, scene, &first_hit);
+                        px.dist = first_hit.depth;
+                        px.age = 0;
+                    }
+                    else
+                        px.age = PixelHistory::not_traced;
+                }
+            });
+
+            if (reuse) {
+                reprojectHistory(camera, pattern, fb.W, fb.H);
+                // if the camera didn't move every pixel reprojects to itself, the history doesn't need to be checked
+                bool exact = v == m_historyView && fov_degrees == m_historyFov;
+                for (unsigned int r = 0; r < fb.H; r++)
+                    for (unsigned int c = 0; c < fb.W; c++)
+                        if (m_current[c + r * fb.W].age == PixelHistory::not_traced)
+                            fillPixel(c, r, pattern, exact, fb.W, fb.H);
+            }
+
+            for (unsigned int i = 0; i < size; i++)
+                fb.buffer[i] = toRGBA32(m_current[i].col);
 
+            m_history.swap(m_current);
+            m_historyView = v;
+            m_historyFov = fov_degrees;
+        }
+
+        // same result as render, but the surfaces seen by the primary rays are found by rasterizing the scene
+        // (see VisibilityBuffer), so we only intersect each primary ray with the one triangle we know it hits.
+        // Shadow rays and reflections are traced as usual
+        void renderHybrid(const Scene &scene,
+                          const glm::mat4 &v,
+                          const float fov_degrees,
+                          unsigned int depth,
+                          FrameBuffer <uint32_t> &fb) {
+
+            CameraRays camera(v, fov_degrees, fb.W, fb.H);
+            m_visibility.rasterize(scene, camera, fb.W, fb.H);
+
+            parallelFor(0, fb.H, [&](unsigned int r){
+                for (unsigned int c = 0; c < fb.W; c++){
+                    const VisibilityBuffer::Pixel &px = m_visibility.at(c, r);
+                    Ray ray = camera.rayAt(c, r);
+                    Hit hit;
+                    color col = black;
+                    if (px.instance >= 0) {
+                        // pixels on the edge of a triangle may be missed by the ray-triangle test, we trace those
+                        if (scene.intersectTriangle(ray, px.instance, px.triangle, hit))
+                            col = shade(ray, hit, depth, scene);
+                        else
+                            col = traceRay(ray, depth, scene);
+                    }
+                    fb.buffer[c + r * fb.W] = toRGBA32(col);
+                }
+            });
+        }
+
+        // number of pixels that are still receiving samples in renderProgressive
+        unsigned int activePixels() const {
+            unsigned int count = 0;
+            for (unsigned int i = 0; i < m_samples.size(); i++)
+                if (m_samples[i] < max_samples && !converged(i)) count++;
+            return count;
+        }
+
+        // if first_hit is not null, the properties of the surface that was hit are written to it
+        // (the renderer calls traceRay from several threads, so it must not change the state of the renderer)
         color traceRay(const Ray & ray,
                        unsigned int depth,
-                       const std::vector<vertex> &vts){
+                       const Scene &scene,
+                       SurfaceSample *first_hit = nullptr,
+                       RussianRoulette *rr = nullptr){
+
+            Hit hitInfo; // used to store the hit information
+            if (!scene.intersect(ray, hitInfo)) return black; // no hit, return black
+
+            return shade(ray, hitInfo, depth, scene, first_hit, rr);
+        }
+
+        // color of the surface hit by a ray (including its reflections), hitInfo is the result of intersecting the ray with the scene
+        color shade(const Ray & ray,
+                    const Hit & hitInfo,
+                    unsigned int depth,
+                    const Scene &scene,
+                    SurfaceSample *first_hit = nullptr,
+                    RussianRoulette *rr = nullptr){
             // this is here to ensure we don't end up with a long recursion that can freeze the program (or cause a stack overflow)
             depth = depth > max_recursion ? max_recursion : depth;
-
             color col = black; // used to output a color
-            Hit hitInfo; // used to store the hit information
-            if (!rayModelIntersection(ray, vts, hitInfo)) return col; // no hit, return black
 
+            // vertices of the mesh that was hit, they are in the object space of the instance
+            const Instance &inst = scene.instances[hitInfo.instance_ID];
+            const std::vector<vertex> &vts = scene.meshes[inst.mesh].vts;
 
             // TODO ex 10.2 replace the current i_normal and i_col computation with their interpolated versions
             vec3 i_normal = vts[hitInfo.hit_ID].norm * hitInfo.barycentric.x + vts[hitInfo.hit_ID+1].norm * hitInfo.barycentric.y + vts[hitInfo.hit_ID+2].norm * hitInfo.barycentric.z;
-            i_normal = normalize(i_normal);
+            i_normal = normalize(inst.normal_matrix * i_normal); // from object to world space
             color i_col = vts[hitInfo.hit_ID].col * hitInfo.barycentric.x + vts[hitInfo.hit_ID+1].col * hitInfo.barycentric.y + vts[hitInfo.hit_ID+2].col * hitInfo.barycentric.z;
 
             vec3 i_pos = ray.origin + ray.direction * hitInfo.dist;
 
+            if (first_hit) {
+                first_hit->normal = i_normal;
+                first_hit->depth = hitInfo.dist;
+                first_hit->albedo = vec3(i_col);
+            }
+
             // TODO ex 10.3 implement the phong reflection model for the point light below
             float ambient = 0.1f, diffuse = 0.5f, specular = 0.5f, shininess = 10;
-            vec3 light_pos(0,1.9f,0); // light position in model space
             vec3 light_dir = normalize(light_pos - i_pos);
 
             col = ambient * i_col;
@@ -97,9 +416,9 @@ namespace rt{
             // TODO ex 10.4 check if the light source is visible from i_pos, we only use the diffuse and specular components if that is the case
             Ray shadow_ray(i_pos + i_normal * .001f, light_dir); // i_normal * .001f is handling numerical precision issues, it prevents self-intersection
             float light_dist = length(light_pos - i_pos);
-            Hit shadow_hit;
-            // check if there is geometry in the direction of the light, and if the closest geometry is closer than the light source
-            if (rayModelIntersection(shadow_ray, vts, shadow_hit) && light_dist < shadow_hit.dist) {
+            // check if there is any geometry in the direction of the light that is closer than the light source,
+            // we don't care which one is the closest, so we use the cheaper occlusion query
+            if (!scene.occluded(shadow_ray, light_dist)) {
                 // the light is visible from i_pos (there is no occlusion), so we compute direct lighting
                 col += diffuse * i_col * max(dot(light_dir, i_normal), .0f) +
                        specular * pow(max(dot(light_dir, i_normal), .0f), shininess);
@@ -107,73 +426,209 @@ namespace rt{
 
             // the recursion/reflection happens here!
             if (depth > 1) {
+                float weight = p_rg;
+                // with russian roulette, the path may end here
+                if (rr) {
+                    if (rr->next01() >= rr->survival) return col;
+                    weight /= rr->survival;
+                }
                 Ray reflected_ray(i_pos, reflect(ray.direction, i_normal));
                 reflected_ray.origin -= ray.direction * .001f; // this is a small offset to address numerical precision issues
                 // integrate the current color with the reflection color by a p_rg factor
-                col += p_rg * traceRay(reflected_ray, depth - 1, vts);
+                col += weight * traceRay(reflected_ray, depth - 1, scene, nullptr, rr);
             }
 
             return col;
         }
 
-        // returns false if no intersection
-        // intersection results are returned in the "hit" reference variable
-        static bool rayModelIntersection(const Ray & ray,
-                                         const std::vector<vertex> &vts,
-                                         Hit &hit){
-            for (int i = 0; i < vts.size(); i+=3)
-            {
-                float dist_temp;
-                vec3 barycentric_temp;
-                // notice that we use the hit.dist to ensure that when new intersections happen, these are closer to the
-                // projection convergence point (camera position in our case) than the previously stored hit.
-                if (rayTriangleIntersection(ray, vts[i], vts[i+1], vts[i+2], dist_temp, barycentric_temp) && dist_temp < hit.dist)
-                {
-                    hit.hit_ID = i;
-                    hit.dist = dist_temp;
-                    hit.barycentric = barycentric_temp;
+    private:
+        // hybrid rendering, primary visibility
+        VisibilityBuffer m_visibility;
+
+        // denoised rendering buffers
+        GBuffer m_gbuffer;
+        std::vector<color> m_noisy;
+
+        // progressive rendering state, one entry per pixel
+        std::vector<color> m_accum;         // sum of the sampled colors
+        std::vector<float> m_lumSum;        // sum of the sampled luminance
+        std::vector<float> m_lumSqSum;      // sum of the squared sampled luminance, used to estimate the variance
+        std::vector<unsigned int> m_samples;// number of samples
+        FrameKey m_progressiveKey;
+
+        // interleaved rendering state
+        std::vector<PixelHistory> m_history;     // previous frame
+        std::vector<PixelHistory> m_current;     // frame being rendered
+        std::vector<PixelHistory> m_reprojected; // previous frame as seen from the current camera
+        mat4 m_historyView = mat4(1);
+        float m_historyFov = 0;
+        unsigned int m_interleavedFrame = 0;
+        FrameKey m_interleavedKey;
+
+        // budgeted rendering state
+        std::vector<color> m_budgetPreview;       // one sample per pixel at m_previewDepth
+        std::vector<color> m_budgetAccum;         // sum of the full depth samples
+        std::vector<unsigned int> m_budgetSamples;// number of full depth samples
+        unsigned int m_budgetCursor = 0;
+        unsigned int m_previewDepth = 1;
+        unsigned int m_previewStride = 1;
+        FrameKey m_budgetKey;
+        // running estimates of the time (in seconds) it takes to trace one pixel, for each recursion depth of
+        // the preview and for the refinement samples. They are wall clock times, so they account for the number of cores.
+        // m_depthCost is indexed by recursion depth, so it has max_recursion + 1 entries
+        float m_depthCost[6] = {0, 0, 0, 0, 0, 0};
+        float m_refineCost = 0;
+
+        void resetAccumulation(const FrameKey &key){
+            m_accum.assign(key.size, color(0));
+            m_lumSum.assign(key.size, 0);
+            m_lumSqSum.assign(key.size, 0);
+            m_samples.assign(key.size, 0);
+            m_progressiveKey = key;
+        }
+
+        // true if pixel (x, y) is traced in this phase of the pattern
+        static bool isTraced(unsigned int x, unsigned int y, unsigned int phase, unsigned int pattern){
+            if (pattern == 2) return ((x + y + phase) & 1) == 0;
+            // the 2x2 blocks are visited in diagonal order, so consecutive frames are far apart
+            static const unsigned int order[4] = {0, 3, 1, 2};
+            return (x & 1) + 2 * (y & 1) == order[phase];
+        }
+
+        // moves every pixel of the history to the world position it saw (using the camera of the previous frame)
+        // and splats it to the pixel it projects to with the current camera, the closest one wins
+        void reprojectHistory(const CameraRays &camera, unsigned int pattern, unsigned int W, unsigned int H){
+            CameraRays history_camera(m_historyView, m_historyFov, W, H);
+            m_reprojected.assign(W * H, PixelHistory());
+            for (PixelHistory &px : m_reprojected) px.age = PixelHistory::not_traced;
+
+            for (unsigned int r = 0; r < H; r++){
+                for (unsigned int c = 0; c < W; c++){
+                    const PixelHistory &px = m_history[c + r * W];
+                    // background pixels have no position, and old pixels are traced again before they get any older
+                    if (px.dist == FLT_MAX || px.age + 1 >= pattern) continue;
+
+                    Ray ray = history_camera.rayAt(c, r);
+                    vec2 pixel; float dist;
+                    if (!camera.project(ray.origin + ray.direction * px.dist, pixel, dist)) continue;
+                    int x = int(floor(pixel.x + .5f)), y = int(floor(pixel.y + .5f));
+                    if (x < 0 || y < 0 || x >= int(W) || y >= int(H)) continue;
+
+                    PixelHistory &target = m_reprojected[x + y * W];
+                    if (dist < target.dist) {
+                        target.col = px.col;
+                        target.dist = dist;
+                        target.age = px.age + 1;
+                    }
                 }
             }
-            return hit.hit_ID < 0 ? false : true;
         }
 
-        // returns false if no intersection
-        static bool rayTriangleIntersection(const Ray & ray,
-                                            const vertex & p1,
-                                            const vertex & p2,
-                                            const vertex & p3,
-                                            float & t, vec3 & barycentric)
-        {
-            vec3 e1 = p2.pos - p1.pos;
-            vec3 e2 = p3.pos - p1.pos;
-            vec3 q = cross(ray.direction, e2);
-            float a = dot(e1, q);
-
-            float tolerance = 10e-7f;
-            // for numerical stability, a = 0 means that triangle plane and ray are parallel
-            if (abs(a) < tolerance) return false;
+        // fills a pixel that was not traced in this frame, with its reprojected history if it agrees with the
+        // traced neighbours, otherwise with the two opposite traced neighbours that are more alike (edge directed)
+        void fillPixel(unsigned int x, unsigned int y, unsigned int pattern, bool exact, unsigned int W, unsigned int H){
+            // pairs of opposite neighbours: horizontal, vertical and both diagonals
+            static const int pairs[4][2][2] = {{{-1, 0}, {1, 0}}, {{0, -1}, {0, 1}}, {{-1, -1}, {1, 1}}, {{-1, 1}, {1, -1}}};
+            auto traced = [&](int dx, int dy) -> const PixelHistory* {
+                int nx = int(x) + dx, ny = int(y) + dy;
+                if (nx < 0 || ny < 0 || nx >= int(W) || ny >= int(H)) return nullptr;
+                const PixelHistory &n = m_current[nx + ny * W];
+                return n.age == 0 ? &n : nullptr;
+            };
+
+            // range of distances of the traced neighbours
+            float min_dist = FLT_MAX, max_dist = 0;
+            color sum(0); unsigned int count = 0;
+            for (int dy = -1; dy <= 1; dy++)
+                for (int dx = -1; dx <= 1; dx++)
+                    if (const PixelHistory *n = traced(dx, dy)) {
+                        min_dist = std::min(min_dist, n->dist);
+                        max_dist = std::max(max_dist, n->dist);
+                        sum += n->col; count++;
+                    }
+
+            PixelHistory &px = m_current[x + y * W];
+            const PixelHistory &reprojected = m_reprojected[x + y * W];
+            // a reprojected surface that is not in front of or behind the traced surfaces around it was
+            // either occluded in the previous frame or wrongly reprojected, we don't trust it
+            if (reprojected.age != PixelHistory::not_traced &&
+                (exact || count == 0 || (reprojected.dist >= min_dist * (1 - reprojection_tolerance) &&
+                                (max_dist == FLT_MAX || reprojected.dist <= max_dist * (1 + reprojection_tolerance))))) {
+                px = reprojected;
+                return;
+            }
 
-            float f = 1.0f / a;
-            vec3 s = ray.origin - vec3(p1.pos);
-            float u = f * dot(s, q);
+            // spatial interpolation, it is not reprojected in the next frame
+            px.age = pattern;
+            float best = FLT_MAX;
+            for (auto &pair : pairs) {
+                const PixelHistory *a = traced(pair[0][0], pair[0][1]), *b = traced(pair[1][0], pair[1][1]);
+                if (!a || !b) continue;
+                // both missed the scene: they are alike; only one missed: they are not alike at all
+                float difference = a->dist == b->dist ? 0 : (a->dist == FLT_MAX || b->dist == FLT_MAX ? FLT_MAX * .5f : std::abs(a->dist - b->dist));
+                if (difference < best) {
+                    best = difference;
+                    px.col = (a->col + b->col) * .5f;
+                    px.dist = std::min(a->dist, b->dist);
+                }
+            }
+            if (best == FLT_MAX) {
+                px.col = count ? sum / float(count) : black;
+                px.dist = min_dist;
+            }
+        }
 
-            // if u < 0, intersection with plane is not within the triangle
-            if (u < -tolerance) return false;
+        static void updateCost(float &estimate, float measured){
+            // exponential moving average, it follows changes in the scene and in the load of the machine
+            estimate = estimate > 0 ? 0.8f * estimate + 0.2f * measured : measured;
+        }
 
-            vec3 r = cross(s, e1);
-            float v = f * dot(ray.direction, r);
+        // the cost of a depth that was never measured is extrapolated from the closest measured one,
+        // every reflection adds about the same work (one closest hit and one shadow ray)
+        float estimatedCost(unsigned int depth) const {
+            if (m_depthCost[depth] > 0) return m_depthCost[depth];
+            for (unsigned int d = depth - 1; d >= 1; d--)
+                if (m_depthCost[d] > 0) return m_depthCost[d] * depth / d;
+            for (unsigned int d = depth + 1; d <= max_recursion; d++)
+                if (m_depthCost[d] > 0) return m_depthCost[d] * depth / d;
+            return FLT_MAX;
+        }
 
-            // if v < 0 or u+v > 1, intersection with plane is not within the triangle
-            if (v < -tolerance || u + v > 1) return false;
+        // deepest recursion whose estimated cost per pixel fits the budget, depth 1 if none does
+        unsigned int chooseDepth(unsigned int max_depth, float pixel_budget) const {
+            unsigned int depth = 1;
+            for (unsigned int d = 2; d <= max_depth; d++)
+                if (estimatedCost(d) <= pixel_budget) depth = d;
+            return depth;
+        }
 
-            t = f * dot(e2, r);
+        bool converged(unsigned int i) const {
+            unsigned int n = m_samples[i];
+            if (n < min_samples) return false;
+            float mean = m_lumSum[i] / n;
+            float variance = max(m_lumSqSum[i] / n - mean * mean, 0.0f);
+            // standard error of the mean, it goes down as 1/sqrt(n) for noisy pixels and it is 0 for flat ones
+            return sqrt(variance / n) < convergence_error;
+        }
 
-            if (t < 0)
-                return false;
+        static float luminance(const color &c){
+            return dot(vec3(c), vec3(0.2126f, 0.7152f, 0.0722f));
+        }
 
-            barycentric = vec3(1.0f - u - v, u, v);
+        // offset of sample n of a pixel from the pixel location, in [-0.5, 0.5) so that the samples are centered on it
+        // and the accumulated image doesn't move from the first sample, which has no offset
+        static vec2 pixelJitter(unsigned int pixel, unsigned int sample){
+            if (sample == 0) return vec2(0);
+            return vec2(random01(pixel, sample, 0), random01(pixel, sample, 1)) - 0.5f;
+        }
 
-            return true;
+        // deterministic random number in [0, 1) for a pixel, sample and dimension (integer hash, no shared state)
+        static float random01(unsigned int pixel, unsigned int sample, unsigned int dimension){
+            uint32_t h = pixel * 0x9E3779B1u ^ sample * 0x85EBCA77u ^ dimension * 0xC2B2AE3Du;
+            h ^= h >> 16; h *= 0x7FEB352Du;
+            h ^= h >> 15; h *= 0x846CA68Bu;
+            h ^= h >> 16;
+            return (h >> 8) * (1.0f / 16777216.0f);
         }
     };
 }
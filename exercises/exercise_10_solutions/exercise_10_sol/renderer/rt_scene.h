@@ -0,0 +1,251 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_SCENE_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_SCENE_H
+
+#include <vector>
+#include <cassert>
+#include <future>
+#include <chrono>
+#include <glm/glm.hpp>
+#include "rt_types.h"
+#include "rt_intersection.h"
+#include "rt_bvh.h"
+#include "rt_wide_bvh.h"
+#include "rt_bvh_cache.h"
+
+namespace rt{
+
+    // triangle geometry (3 consecutive vertices per triangle) and its bottom level acceleration structure
+    // the vertices are in the object space of the mesh, meshes are placed in the world by instances
+    struct Mesh{
+        std::vector<vertex> vts;
+        BVH bvh;
+        // compressed 8-wide version of the bvh, used instead of it when available (see compress)
+        WideBVH wide_bvh;
+        // SAH cost of the bvh right after it was built, refits are compared against it
+        float built_cost = 0;
+        // full rebuild running in the background, if any
+        std::future<BVH> rebuild;
+
+        std::vector<AABB> triangleBounds() const {
+            std::vector<AABB> triangle_bounds(vts.size() / 3);
+            for (unsigned int t = 0; t < triangle_bounds.size(); t++){
+                triangle_bounds[t].grow(glm::vec3(vts[t * 3].pos));
+                triangle_bounds[t].grow(glm::vec3(vts[t * 3 + 1].pos));
+                triangle_bounds[t].grow(glm::vec3(vts[t * 3 + 2].pos));
+            }
+            return triangle_bounds;
+        }
+
+        // if a cache is given, the bvh is loaded from it when possible, otherwise it is built and stored in the cache
+        void buildBVH(const BVHCache *cache = nullptr){
+            uint64_t hash = cache ? hashVertexPositions(vts) : 0;
+            if (!cache || !cache->load(hash, vts.size() / 3, bvh)) {
+                bvh.build(triangleBounds());
+                if (cache) cache->store(hash, vts.size() / 3, bvh);
+            }
+            built_cost = bvh.sahCost();
+        }
+
+        bool compressed() const { return !wide_bvh.empty(); }
+
+        // replace the binary bvh by the compressed wide bvh, for meshes that won't be animated
+        // trees with leaves too big for the wide nodes stay binary
+        void compress(){
+            if (!wide_bvh.collapse(bvh)) return;
+            bvh.nodes.clear(); bvh.nodes.shrink_to_fit();
+            bvh.indices.clear(); bvh.indices.shrink_to_fit();
+        }
+
+        AABB bounds() const {
+            return compressed() ? wide_bvh.root_bounds : bvh.bounds();
+        }
+
+        template <class PrimitiveTest>
+        bool intersect(const Ray &ray, float &tmax, PrimitiveTest test) const {
+            return compressed() ? wide_bvh.intersect(ray, tmax, test) : bvh.intersect(ray, tmax, test);
+        }
+
+        template <class PrimitiveTest>
+        bool occluded(const Ray &ray, float tmax, PrimitiveTest test) const {
+            return compressed() ? wide_bvh.occluded(ray, tmax, test) : bvh.occluded(ray, tmax, test);
+        }
+    };
+
+    // a mesh placed in the world with a transformation, many instances can share the same mesh
+    struct Instance{
+        unsigned int mesh;
+        glm::mat4 transform;        // object to world
+        glm::mat4 inverse;          // world to object, used to move rays to the object space
+        glm::mat3 normal_matrix;    // inverse transpose of the transform, used to move normals to the world space
+        AABB bounds;                // world space bounds
+    };
+
+    // two level scene: a bottom level BVH per mesh, and a top level BVH over the instances
+    // moving an instance only requires rebuilding the top level, which is very cheap (one node per instance)
+    class Scene{
+    public:
+        std::vector<Mesh> meshes;
+        std::vector<Instance> instances;
+
+        // refitted bottom level structures are rebuilt when their SAH cost grows by this factor
+        float rebuild_threshold = 1.5f;
+
+        // if set, the BVHs of new meshes are loaded from (and stored to) this cache, see addMesh
+        const BVHCache *bvh_cache = nullptr;
+
+        // returns the index of the new mesh
+        unsigned int addMesh(std::vector<vertex> vts){
+            meshes.push_back(Mesh());
+            meshes.back().vts = std::move(vts);
+            meshes.back().buildBVH(bvh_cache);
+            m_dirty = true;
+            return meshes.size() - 1;
+        }
+
+        // returns the index of the new instance
+        unsigned int addInstance(unsigned int mesh, const glm::mat4 &transform){
+            instances.push_back(Instance());
+            instances.back().mesh = mesh;
+            setTransform(instances.size() - 1, transform);
+            return instances.size() - 1;
+        }
+
+        void setTransform(unsigned int instance, const glm::mat4 &transform){
+            Instance &inst = instances[instance];
+            inst.transform = transform;
+            inst.inverse = glm::inverse(transform);
+            inst.normal_matrix = glm::transpose(glm::mat3(inst.inverse));
+            inst.bounds = meshes[inst.mesh].bounds().transformed(transform);
+            m_dirty = true;
+        }
+
+        // replace the vertices of a mesh that has been animated, the number of vertices must not change
+        // the bottom level BVH is refitted to the new vertex positions, which is fast enough to do every frame. When
+        // the refitted tree becomes too slow to traverse (its SAH cost is rebuild_threshold times the cost it had when
+        // it was built) a full rebuild is started in the background, and used by update() once it is ready
+        void updateMesh(unsigned int mesh_idx, const std::vector<vertex> &vts){
+            Mesh &mesh = meshes[mesh_idx];
+            assert(vts.size() == mesh.vts.size());
+            mesh.vts = vts;
+            // compressed bvhs can't be refitted, animated meshes go back to a binary bvh
+            if (mesh.compressed()) {
+                mesh.wide_bvh.clear();
+                mesh.buildBVH();
+            }
+
+            std::vector<AABB> triangle_bounds = mesh.triangleBounds();
+            mesh.bvh.refit(triangle_bounds);
+
+            if (!mesh.rebuild.valid() && mesh.bvh.sahCost() > rebuild_threshold * mesh.built_cost) {
+                // the rebuild only needs the triangle bounds, we give it a copy so that it doesn't share data with this thread
+                unsigned int max_leaf_size = mesh.bvh.max_leaf_size;
+                mesh.rebuild = std::async(std::launch::async, [triangle_bounds, max_leaf_size]() {
+                    BVH bvh;
+                    bvh.max_leaf_size = max_leaf_size;
+                    bvh.build(triangle_bounds);
+                    return bvh;
+                });
+            }
+
+            for (unsigned int i = 0; i < instances.size(); i++)
+                if (instances[i].mesh == mesh_idx)
+                    instances[i].bounds = mesh.bounds().transformed(instances[i].transform);
+            m_dirty = true;
+        }
+
+        // use a compressed 8-wide bvh for a mesh that is not animated, this reduces its memory and cache footprint
+        void compressMesh(unsigned int mesh_idx){
+            meshes[mesh_idx].compress();
+        }
+
+        // rebuild the top level structure if instances have been added or moved, and swap in the bottom level structures
+        // that finished rebuilding in the background. Call it before rendering
+        void update(){
+            for (Mesh &mesh : meshes) {
+                if (mesh.rebuild.valid() && mesh.rebuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                    // the triangles may have moved while the rebuild was running, but the new topology is still valid
+                    // for the same triangles, so we only need to refit it to the current vertices
+                    mesh.bvh = mesh.rebuild.get();
+                    mesh.bvh.refit(mesh.triangleBounds());
+                    mesh.built_cost = mesh.bvh.sahCost();
+                    m_dirty = true;
+                }
+            }
+            if (!m_dirty) return;
+            std::vector<AABB> instance_bounds(instances.size());
+            for (unsigned int i = 0; i < instances.size(); i++)
+                instance_bounds[i] = instances[i].bounds;
+            m_tlas.max_leaf_size = 1;
+            m_tlas.build(instance_bounds);
+            m_dirty = false;
+            m_version++;
+        }
+
+        // incremented every time the scene changes, renderers that keep results across frames use it to detect changes
+        unsigned int version() const { return m_version; }
+
+        // returns false if no intersection
+        // intersection results are returned in the "hit" reference variable, hit.dist is in world space units
+        bool intersect(const Ray &ray, Hit &hit) const {
+            return m_tlas.intersect(ray, hit.dist, [&](uint32_t inst_idx, float &tmax) -> bool {
+                const Instance &inst = instances[inst_idx];
+                const Mesh &mesh = meshes[inst.mesh];
+                // the object space direction is not normalized, so distances along it are the same as in world space
+                Ray obj_ray(glm::vec3(inst.inverse * glm::vec4(ray.origin, 1)), glm::vec3(inst.inverse * glm::vec4(ray.direction, 0)));
+
+                return mesh.intersect(obj_ray, tmax, [&](uint32_t tri, float &tmax_obj) -> bool {
+                    float t; glm::vec3 barycentric;
+                    if (rayTriangleIntersection(obj_ray, mesh.vts[tri * 3], mesh.vts[tri * 3 + 1], mesh.vts[tri * 3 + 2], t, barycentric)
+                        && t < tmax_obj) {
+                        tmax_obj = t;
+                        hit.dist = t;
+                        hit.hit_ID = tri * 3;
+                        hit.instance_ID = inst_idx;
+                        hit.barycentric = barycentric;
+                        return true;
+                    }
+                    return false;
+                });
+            });
+        }
+
+        // intersection with a single triangle (tri is the index of the triangle, not of its first vertex) of an instance,
+        // used when we already know which triangle is visible (see VisibilityBuffer). The results are the same as intersect
+        bool intersectTriangle(const Ray &ray, unsigned int inst_idx, unsigned int tri, Hit &hit) const {
+            const Instance &inst = instances[inst_idx];
+            const Mesh &mesh = meshes[inst.mesh];
+            Ray obj_ray(glm::vec3(inst.inverse * glm::vec4(ray.origin, 1)), glm::vec3(inst.inverse * glm::vec4(ray.direction, 0)));
+
+            float t; glm::vec3 barycentric;
+            if (!rayTriangleIntersection(obj_ray, mesh.vts[tri * 3], mesh.vts[tri * 3 + 1], mesh.vts[tri * 3 + 2], t, barycentric))
+                return false;
+            hit.dist = t;
+            hit.hit_ID = tri * 3;
+            hit.instance_ID = inst_idx;
+            hit.barycentric = barycentric;
+            return true;
+        }
+
+        // returns true if any triangle intersects the ray at a distance in the range [0, tmax]
+        // unlike intersect, this is an any-hit query: it stops at the first intersection it finds, so
+        // it should be used whenever we only need to know if something is in the way (e.g. shadow rays).
+        bool occluded(const Ray &ray, float tmax) const {
+            return m_tlas.occluded(ray, tmax, [&](uint32_t inst_idx, float tmax) -> bool {
+                const Instance &inst = instances[inst_idx];
+                const Mesh &mesh = meshes[inst.mesh];
+                Ray obj_ray(glm::vec3(inst.inverse * glm::vec4(ray.origin, 1)), glm::vec3(inst.inverse * glm::vec4(ray.direction, 0)));
+
+                return mesh.occluded(obj_ray, tmax, [&](uint32_t tri, float tmax_obj) -> bool {
+                    return rayTriangleOcclusion(obj_ray, mesh.vts[tri * 3], mesh.vts[tri * 3 + 1], mesh.vts[tri * 3 + 2], tmax_obj);
+                });
+            });
+        }
+
+    private:
+        BVH m_tlas;
+        bool m_dirty = true;
+        unsigned int m_version = 0;
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_SCENE_H
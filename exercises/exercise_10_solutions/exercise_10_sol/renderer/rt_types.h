@@ -38,6 +38,7 @@ namespace rt{
 
     struct Hit{
         int hit_ID = -1; // negative values for no hit, other values for the index of the first vertex in a triangle
+        int instance_ID = -1; // the scene instance that was hit (if any), hit_ID indexes the vertices of its mesh
         glm::vec3 barycentric; // the barycentric coordinates of the triangle that was hit (if any)
         float dist = FLT_MAX;  // used to store the intersection distance
     };
@@ -0,0 +1,143 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_VISIBILITY_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_VISIBILITY_H
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "rt_types.h"
+#include "rt_scene.h"
+#include "rt_camera.h"
+#include "rt_parallel.h"
+
+namespace rt{
+
+    // the triangle seen through each pixel, found by rasterizing the scene instead of tracing primary rays
+    //
+    // we rasterize in homogeneous coordinates (Olano and Greer 1997): the camera is at the origin of the camera space,
+    // and the primary ray of pixel (x, y) has direction d(x, y), which is linear in x and y. The ray crosses the
+    // triangle (a, b, c) when the three triple products dot(d, cross(a, b)), dot(d, cross(b, c)) and dot(d, cross(c, a))
+    // have the same sign, so each of them is an edge function we can evaluate at every pixel. Unlike the usual
+    // rasterization pipeline, no clipping is needed for triangles that cross the camera plane, and the pixel locations
+    // are exactly the ones used by CameraRays::rayAt
+    class VisibilityBuffer{
+    public:
+        struct Pixel{
+            int instance = -1;  // -1 if no triangle covers the pixel
+            int triangle = -1;  // index of the triangle in the mesh of the instance
+            float t = FLT_MAX;  // distance along the (not normalized) camera space direction, used for the depth test
+        };
+
+        unsigned int W = 0, H = 0;
+        std::vector<Pixel> pixels;
+
+        const Pixel &at(unsigned int x, unsigned int y) const { return pixels[x + y * W]; }
+
+        void rasterize(const Scene &scene, const CameraRays &camera, unsigned int width, unsigned int height){
+            W = width; H = height;
+            pixels.assign(W * H, Pixel());
+            setupTriangles(scene, camera);
+
+            // the image is split in bands of rows, every band rasterizes all triangles that overlap it,
+            // so threads never write to the same pixel
+            const unsigned int band_height = 8;
+            parallelFor(0, (H + band_height - 1) / band_height, [&](unsigned int band){
+                int y_begin = band * band_height, y_end = std::min((band + 1) * band_height, H) - 1;
+                for (const TriangleSetup &tri : m_triangles)
+                    rasterTriangle(tri, camera, std::max(tri.y_min, y_begin), std::min(tri.y_max, y_end));
+            });
+        }
+
+    private:
+        struct TriangleSetup{
+            glm::vec3 edge[3];      // normals of the planes through the camera and each edge
+            glm::vec3 normal;       // plane of the triangle, dot(normal, p) == plane_distance
+            float plane_distance;
+            int x_min, x_max, y_min, y_max; // pixels that may be covered
+            int instance, triangle;
+        };
+
+        std::vector<TriangleSetup> m_triangles;
+
+        void setupTriangles(const Scene &scene, const CameraRays &camera){
+            m_triangles.clear();
+            for (unsigned int i = 0; i < scene.instances.size(); i++){
+                const Instance &inst = scene.instances[i];
+                const std::vector<vertex> &vts = scene.meshes[inst.mesh].vts;
+                glm::mat4 object_to_view = camera.world_to_view * inst.transform;
+
+                for (unsigned int t = 0; t < vts.size() / 3; t++){
+                    glm::vec3 a = glm::vec3(object_to_view * vts[t * 3].pos);
+                    glm::vec3 b = glm::vec3(object_to_view * vts[t * 3 + 1].pos);
+                    glm::vec3 c = glm::vec3(object_to_view * vts[t * 3 + 2].pos);
+
+                    TriangleSetup setup;
+                    setup.normal = glm::cross(b - a, c - a);
+                    // degenerate triangles can't be seen
+                    if (glm::dot(setup.normal, setup.normal) == 0) continue;
+                    // the triangle is behind the camera
+                    if (a.z >= 0 && b.z >= 0 && c.z >= 0) continue;
+
+                    setup.plane_distance = glm::dot(setup.normal, a);
+                    setup.edge[0] = glm::cross(a, b);
+                    setup.edge[1] = glm::cross(b, c);
+                    setup.edge[2] = glm::cross(c, a);
+                    setup.instance = i;
+                    setup.triangle = t;
+
+                    if (!screenBounds(camera, a, b, c, setup)) continue;
+                    m_triangles.push_back(setup);
+                }
+            }
+        }
+
+        // range of pixels covered by the projection of the triangle, returns false if it is outside of the image
+        bool screenBounds(const CameraRays &camera, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c, TriangleSetup &setup) const {
+            setup.x_min = 0; setup.x_max = W - 1;
+            setup.y_min = 0; setup.y_max = H - 1;
+            // a triangle that crosses the camera plane projects to an unbounded region, we test all pixels
+            if (a.z >= 0 || b.z >= 0 || c.z >= 0) return true;
+
+            glm::vec2 lo(FLT_MAX), hi(-FLT_MAX);
+            for (const glm::vec3 *p : {&a, &b, &c}) {
+                glm::vec2 pixel = (glm::vec2(*p) / -p->z - glm::vec2(camera.lower_left_corner)) / camera.pixel_size;
+                lo = glm::min(lo, pixel);
+                hi = glm::max(hi, pixel);
+            }
+            // the bounds are rounded outwards, the edge functions decide which pixels are covered
+            setup.x_min = std::max(setup.x_min, int(std::floor(lo.x)));
+            setup.x_max = std::min(setup.x_max, int(std::ceil(hi.x)));
+            setup.y_min = std::max(setup.y_min, int(std::floor(lo.y)));
+            setup.y_max = std::min(setup.y_max, int(std::ceil(hi.y)));
+            return setup.x_min <= setup.x_max && setup.y_min <= setup.y_max;
+        }
+
+        void rasterTriangle(const TriangleSetup &tri, const CameraRays &camera, int y_begin, int y_end){
+            for (int y = y_begin; y <= y_end; y++){
+                for (int x = tri.x_min; x <= tri.x_max; x++){
+                    // camera space direction of the primary ray, the same one CameraRays::rayAt uses
+                    glm::vec3 d(glm::vec2(camera.lower_left_corner) + glm::vec2(x, y) * camera.pixel_size, -1);
+
+                    float e0 = glm::dot(d, tri.edge[0]), e1 = glm::dot(d, tri.edge[1]), e2 = glm::dot(d, tri.edge[2]);
+                    // pixels on an edge are covered by both triangles that share it, the depth test picks one
+                    bool inside = (e0 >= 0 && e1 >= 0 && e2 >= 0) || (e0 <= 0 && e1 <= 0 && e2 <= 0);
+                    if (!inside) continue;
+
+                    float denominator = glm::dot(tri.normal, d);
+                    if (denominator == 0) continue;
+                    float t = tri.plane_distance / denominator;
+
+                    Pixel &px = pixels[x + y * W];
+                    if (t > 0 && t < px.t) {
+                        px.t = t;
+                        px.instance = tri.instance;
+                        px.triangle = tri.triangle;
+                    }
+                }
+            }
+        }
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_VISIBILITY_H
@@ -0,0 +1,373 @@
+#ifndef ITU_GRAPHICS_PROGRAMMING_RT_WIDE_BVH_H
+#define ITU_GRAPHICS_PROGRAMMING_RT_WIDE_BVH_H
+
+#include <vector>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <new>
+#include <glm/glm.hpp>
+#include "rt_types.h"
+#include "rt_intersection.h"
+#include "rt_bvh.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RT_WIDE_BVH_SSE
+#endif
+
+namespace rt{
+
+    // std::allocator only guarantees 16 bytes alignment before C++17, we need the nodes to start at a cache line
+    template <class T, size_t Alignment>
+    struct AlignedAllocator{
+        typedef T value_type;
+        template <class U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+        AlignedAllocator() = default;
+        template <class U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+        T *allocate(size_t n){
+            void *p = nullptr;
+#ifdef _WIN32
+            p = _aligned_malloc(n * sizeof(T), Alignment);
+#else
+            if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0) p = nullptr;
+#endif
+            if (!p) throw std::bad_alloc();
+            return static_cast<T*>(p);
+        }
+
+        void deallocate(T *p, size_t){
+#ifdef _WIN32
+            _aligned_free(p);
+#else
+            free(p);
+#endif
+        }
+
+        template <class U> bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+        template <class U> bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+    };
+
+    // node of an 8-wide BVH, exactly one cache line
+    // the bounds of the children are quantized to 8 bits per plane, relative to the bounds of the node:
+    // child_min = origin + lo * 2^exponent, child_max = origin + hi * 2^exponent
+    // the bounds are stored per axis (structure of arrays) so that the 8 children can be tested at once
+    struct alignas(64) WideBVHNode{
+        float origin[3];
+        int8_t exponent[3];
+        uint8_t child_count;
+        uint8_t lo_x[8], lo_y[8], lo_z[8];
+        uint8_t hi_x[8], hi_y[8], hi_z[8];
+    };
+
+    // the data only needed after a child has been hit, kept out of the node so that the node fits in one cache line
+    // internal children of a node are stored contiguously starting at child_base,
+    // the primitives of its leaf children are stored contiguously starting at primitive_base
+    struct WideBVHLinks{
+        uint32_t child_base;
+        uint32_t primitive_base;
+        // per child, internal: [0] [offset from child_base (7 bits)]
+        //            leaf:     [1] [primitive count - 1 (2 bits)] [offset from primitive_base (5 bits)]
+        uint8_t meta[8];
+
+        bool isLeaf(int i) const { return (meta[i] & 0x80) != 0; }
+        uint32_t child(int i) const { return child_base + (meta[i] & 0x7F); }
+        uint32_t firstPrimitive(int i) const { return primitive_base + (meta[i] & 0x1F); }
+        uint32_t primitiveCount(int i) const { return ((meta[i] >> 5) & 0x3) + 1; }
+    };
+
+    static_assert(sizeof(WideBVHNode) == 64, "wide BVH nodes must fit in a cache line");
+
+    // 8-wide BVH with compressed child bounds, built by collapsing a binary BVH (see collapse)
+    // it uses about a third of the memory of the binary BVH, and each traversal step loads one cache line to
+    // test 8 boxes instead of two. It can't be refitted, so it is meant for static geometry
+    class WideBVH{
+    public:
+        std::vector<WideBVHNode, AlignedAllocator<WideBVHNode, 64> > nodes;
+        std::vector<WideBVHLinks> links;
+        std::vector<uint32_t> indices;
+        AABB root_bounds;
+
+        bool empty() const { return nodes.empty(); }
+
+        void clear(){
+            nodes.clear(); nodes.shrink_to_fit();
+            links.clear(); links.shrink_to_fit();
+            indices.clear(); indices.shrink_to_fit();
+            root_bounds = AABB();
+        }
+
+        size_t memoryUsage() const {
+            return nodes.size() * sizeof(WideBVHNode) + links.size() * sizeof(WideBVHLinks) + indices.size() * sizeof(uint32_t);
+        }
+
+        // build from a binary BVH, returns false (and stays empty) if it has leaves with more than 4 primitives,
+        // which the nodes can't reference (e.g. leaves forced at BVH::max_depth)
+        bool collapse(const BVH &bvh){
+            clear();
+            if (bvh.nodes.empty()) return true;
+            for (const BVHNode &node : bvh.nodes)
+                if (node.count > 4) return false;
+            root_bounds = bvh.nodes[0].bounds;
+
+            if (bvh.nodes[0].isLeaf()) {
+                // a single leaf, we still need an internal node on top of it
+                nodes.push_back(WideBVHNode());
+                links.push_back(WideBVHLinks());
+                uint32_t children[1] = {0};
+                fillNode(0, bvh, children, 1);
+                return true;
+            }
+
+            // each entry is a binary internal node that becomes a wide node, stored at the same position in this queue
+            std::vector<uint32_t> queue(1, 0);
+            nodes.push_back(WideBVHNode());
+            links.push_back(WideBVHLinks());
+            for (size_t q = 0; q < queue.size(); q++) {
+                uint32_t children[8];
+                int count = gatherChildren(bvh, queue[q], children);
+
+                // reserve the internal children contiguously, they are filled when they are popped from the queue
+                links[q].child_base = nodes.size();
+                for (int c = 0; c < count; c++) {
+                    if (!bvh.nodes[children[c]].isLeaf()) {
+                        queue.push_back(children[c]);
+                        nodes.push_back(WideBVHNode());
+                        links.push_back(WideBVHLinks());
+                    }
+                }
+                fillNode(q, bvh, children, count);
+            }
+            return true;
+        }
+
+        // closest hit traversal, same contract as BVH::intersect
+        template <class PrimitiveTest>
+        bool intersect(const Ray &ray, float &tmax, PrimitiveTest test) const {
+            if (nodes.empty()) return false;
+            RayData rd(ray);
+            bool hit = false;
+
+            uint32_t stack[stack_size];
+            float stack_t[stack_size];
+            int top = 0;
+            stack[top] = 0; stack_t[top++] = 0;
+            while (top > 0) {
+                top--;
+                if (stack_t[top] > tmax) continue;
+                uint32_t n = stack[top];
+
+                float t_entry[8];
+                unsigned int mask = intersectChildren(nodes[n], rd, tmax, t_entry);
+                if (!mask) continue;
+                const WideBVHLinks &link = links[n];
+
+                // sort the hit children by distance, far to near, so that the near ones are popped first
+                int order[8], count = 0;
+                for (int c = 0; c < 8; c++) {
+                    if (!(mask & (1u << c))) continue;
+                    int k = count++;
+                    while (k > 0 && t_entry[order[k - 1]] < t_entry[c]) { order[k] = order[k - 1]; k--; }
+                    order[k] = c;
+                }
+                for (int k = 0; k < count; k++) {
+                    int c = order[k];
+                    if (link.isLeaf(c)) continue;
+                    stack[top] = link.child(c); stack_t[top++] = t_entry[c];
+                }
+                // leaves are tested right away, nearest first
+                for (int k = count - 1; k >= 0; k--) {
+                    int c = order[k];
+                    if (!link.isLeaf(c) || t_entry[c] > tmax) continue;
+                    for (uint32_t i = link.firstPrimitive(c), end = i + link.primitiveCount(c); i < end; i++)
+                        hit |= test(indices[i], tmax);
+                }
+            }
+            return hit;
+        }
+
+        // any hit traversal, same contract as BVH::occluded
+        template <class PrimitiveTest>
+        bool occluded(const Ray &ray, float tmax, PrimitiveTest test) const {
+            if (nodes.empty()) return false;
+            RayData rd(ray);
+
+            uint32_t stack[stack_size];
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0) {
+                uint32_t n = stack[--top];
+                float t_entry[8];
+                unsigned int mask = intersectChildren(nodes[n], rd, tmax, t_entry);
+                const WideBVHLinks &link = links[n];
+                // leaves first, they are the only ones that can end the traversal right away
+                for (int c = 0; c < 8; c++) {
+                    if (!(mask & (1u << c))) continue;
+                    if (link.isLeaf(c)) {
+                        for (uint32_t i = link.firstPrimitive(c), end = i + link.primitiveCount(c); i < end; i++)
+                            if (test(indices[i], tmax)) return true;
+                    }
+                    else
+                        stack[top++] = link.child(c);
+                }
+            }
+            return false;
+        }
+
+    private:
+        // every wide node is at least one level deeper in the binary BVH than its parent, so the internal nodes are at
+        // most at depth BVH::max_depth - 1. Visiting a node replaces it with up to 8 children, the stack holds at most
+        // 7 waiting siblings per level above it plus the 8 children of the deepest node
+        static const unsigned int stack_size = 7 * (BVH::max_depth - 1) + 8;
+
+        // per ray values that are used for every node
+        struct RayData{
+            explicit RayData(const Ray &ray){
+                glm::vec3 inv = safeInverse(ray.direction);
+                for (int a = 0; a < 3; a++) {
+                    origin[a] = ray.origin[a];
+                    inv_dir[a] = inv[a];
+                    negative[a] = inv_dir[a] < 0;
+                }
+            }
+            float origin[3];
+            float inv_dir[3];
+            bool negative[3];
+        };
+
+        // binary children of a binary internal node, expanded until there are 8 of them (or no internal ones)
+        // the internal child with the largest surface area is opened first, as in the usual greedy collapse
+        static int gatherChildren(const BVH &bvh, uint32_t node, uint32_t children[8]){
+            int count = 2;
+            children[0] = bvh.nodes[node].first;
+            children[1] = bvh.nodes[node].first + 1;
+            while (count < 8) {
+                int largest = -1;
+                float largest_area = -1;
+                for (int c = 0; c < count; c++) {
+                    const BVHNode &child = bvh.nodes[children[c]];
+                    if (!child.isLeaf() && child.bounds.surfaceArea() > largest_area) {
+                        largest = c;
+                        largest_area = child.bounds.surfaceArea();
+                    }
+                }
+                if (largest < 0) break;
+                uint32_t opened = children[largest];
+                children[largest] = bvh.nodes[opened].first;
+                children[count++] = bvh.nodes[opened].first + 1;
+            }
+            return count;
+        }
+
+        // quantize the children bounds, copy the leaf primitives and set up the child/leaf references
+        // links[n].child_base must already point to the first of the internal children of this node
+        void fillNode(uint32_t n, const BVH &bvh, const uint32_t *children, int count){
+            WideBVHNode &node = nodes[n];
+            WideBVHLinks &link = links[n];
+
+            AABB bounds;
+            for (int c = 0; c < count; c++) bounds.grow(bvh.nodes[children[c]].bounds);
+
+            float scale[3];
+            for (int a = 0; a < 3; a++) {
+                node.origin[a] = bounds.min[a];
+                float extent = bounds.max[a] - bounds.min[a];
+                int e = extent > 0 ? int(std::ceil(std::log2(extent / 255.0f))) : -126;
+                // make sure the rounding of log2 didn't leave the largest bound out of the 8 bits range
+                if (extent > 0 && extent / std::ldexp(1.0f, e) > 255.0f) e++;
+                e = glm::clamp(e, -126, 127);
+                node.exponent[a] = int8_t(e);
+                scale[a] = std::ldexp(1.0f, e);
+            }
+
+            node.child_count = uint8_t(count);
+            link.primitive_base = indices.size();
+            uint8_t *lo[3] = {node.lo_x, node.lo_y, node.lo_z};
+            uint8_t *hi[3] = {node.hi_x, node.hi_y, node.hi_z};
+            uint32_t internal = 0;
+            for (int c = 0; c < 8; c++) {
+                if (c >= count) {
+                    // empty slots are never reported as hit, intersectChildren masks them out using child_count
+                    for (int a = 0; a < 3; a++) { lo[a][c] = 0; hi[a][c] = 0; }
+                    link.meta[c] = 0;
+                    continue;
+                }
+                const BVHNode &child = bvh.nodes[children[c]];
+                for (int a = 0; a < 3; a++) {
+                    // round outwards, so that the quantized box always contains the original one
+                    int q_lo = int(std::floor((child.bounds.min[a] - node.origin[a]) / scale[a]));
+                    int q_hi = int(std::ceil((child.bounds.max[a] - node.origin[a]) / scale[a]));
+                    q_lo = glm::clamp(q_lo, 0, 255);
+                    q_hi = glm::clamp(q_hi, 0, 255);
+                    while (q_lo > 0 && node.origin[a] + q_lo * scale[a] > child.bounds.min[a]) q_lo--;
+                    while (q_hi < 255 && node.origin[a] + q_hi * scale[a] < child.bounds.max[a]) q_hi++;
+                    lo[a][c] = uint8_t(q_lo);
+                    hi[a][c] = uint8_t(q_hi);
+                }
+
+                if (child.isLeaf()) {
+                    uint32_t offset = indices.size() - link.primitive_base;
+                    link.meta[c] = uint8_t(0x80 | ((child.count - 1) << 5) | offset);
+                    for (uint32_t i = child.first; i < child.first + child.count; i++)
+                        indices.push_back(bvh.indices[i]);
+                }
+                else
+                    link.meta[c] = uint8_t(internal++);
+            }
+        }
+
+        // slab test against the 8 children of a node, returns a bit mask of the children that are hit before tmax
+        static unsigned int intersectChildren(const WideBVHNode &node, const RayData &rd, float tmax, float t_entry[8]){
+            // the near and far planes of each axis depend on the sign of the ray direction
+            const uint8_t *near_q[3] = {rd.negative[0] ? node.hi_x : node.lo_x, rd.negative[1] ? node.hi_y : node.lo_y, rd.negative[2] ? node.hi_z : node.lo_z};
+            const uint8_t *far_q[3] = {rd.negative[0] ? node.lo_x : node.hi_x, rd.negative[1] ? node.lo_y : node.hi_y, rd.negative[2] ? node.lo_z : node.hi_z};
+            // t = (origin + q * scale - ray_origin) * inv_dir = q * (scale * inv_dir) + (origin - ray_origin) * inv_dir
+            float q_scale[3], offset[3];
+            for (int a = 0; a < 3; a++) {
+                q_scale[a] = std::ldexp(1.0f, node.exponent[a]) * rd.inv_dir[a];
+                offset[a] = (node.origin[a] - rd.origin[a]) * rd.inv_dir[a];
+            }
+
+#ifdef RT_WIDE_BVH_SSE
+            unsigned int mask = 0;
+            const __m128i zero = _mm_setzero_si128();
+            for (int half = 0; half < 8; half += 4) {
+                __m128 t_near = _mm_setzero_ps();
+                __m128 t_far = _mm_set1_ps(tmax);
+                for (int a = 0; a < 3; a++) {
+                    int32_t n4, f4;
+                    memcpy(&n4, near_q[a] + half, 4);
+                    memcpy(&f4, far_q[a] + half, 4);
+                    // widen 4 x uint8 to 4 x float
+                    __m128 qn = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(n4), zero), zero));
+                    __m128 qf = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(f4), zero), zero));
+                    __m128 s = _mm_set1_ps(q_scale[a]), o = _mm_set1_ps(offset[a]);
+                    t_near = _mm_max_ps(t_near, _mm_add_ps(_mm_mul_ps(qn, s), o));
+                    t_far = _mm_min_ps(t_far, _mm_add_ps(_mm_mul_ps(qf, s), o));
+                }
+                _mm_storeu_ps(t_entry + half, t_near);
+                mask |= unsigned(_mm_movemask_ps(_mm_cmple_ps(t_near, t_far))) << half;
+            }
+            return mask & ((1u << node.child_count) - 1);
+#else
+            unsigned int mask = 0;
+            for (int c = 0; c < 8; c++) {
+                float t_near = 0, t_far = tmax;
+                for (int a = 0; a < 3; a++) {
+                    t_near = glm::max(t_near, near_q[a][c] * q_scale[a] + offset[a]);
+                    t_far = glm::min(t_far, far_q[a][c] * q_scale[a] + offset[a]);
+                }
+                t_entry[c] = t_near;
+                mask |= unsigned(t_near <= t_far) << c;
+            }
+            return mask & ((1u << node.child_count) - 1);
+#endif
+        }
+    };
+}
+
+#endif //ITU_GRAPHICS_PROGRAMMING_RT_WIDE_BVH_H
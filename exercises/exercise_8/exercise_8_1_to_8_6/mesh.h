@@ -41,14 +41,28 @@ public:
         this->indices = indices;
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        // meshes with up to 65536 vertices use 16 bit indices, the index buffer is half the size
+        if (vertices.size() <= 65536) {
+            std::vector<unsigned short> shortIndices(indices.begin(), indices.end());
+            setupMesh(vertices.data(), vertices.size(), shortIndices.data(), shortIndices.size(), GL_UNSIGNED_SHORT);
+        }
+        else
+            setupMesh(vertices.data(), vertices.size(), indices.data(), indices.size(), GL_UNSIGNED_INT);
+    }
+
+    // creates the mesh directly from vertex and index data in memory (e.g. a mapped file), which must have the
+    // layout of the Vertex struct and indices of the given type (GL_UNSIGNED_SHORT or GL_UNSIGNED_INT).
+    // The data is only uploaded to the GPU, the vertices and indices vectors stay empty
+    Mesh(const void * vertexData, unsigned int vertexCount, const void * indexData, unsigned int indexCount, GLenum indexType)
+    {
+        setupMesh(vertexData, vertexCount, indexData, indexCount, indexType);
     }
 
     // render the mesh
     void Draw()
     {
         glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+        glDrawElements(GL_TRIANGLES, indexCount, indexType, 0);
         glBindVertexArray(0);
 
         // always good practice to set everything back to defaults once configured.
@@ -58,11 +72,17 @@ public:
 private:
     /*  Render data  */
     unsigned int VBO, EBO;
+    unsigned int indexCount;
+    // GL_UNSIGNED_SHORT if all the indices fit in 16 bits, GL_UNSIGNED_INT otherwise
+    GLenum indexType;
 
     /*  Functions    */
     // initializes all the buffer objects/arrays
-    void setupMesh()
+    void setupMesh(const void * vertexData, size_t vertexCount, const void * indexData, size_t indexCount, GLenum indexType)
     {
+        this->indexCount = indexCount;
+        this->indexType = indexType;
+
         // create buffers/arrays
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
@@ -74,10 +94,11 @@ private:
         // A great thing about structs is that their memory layout is sequential for all its items.
         // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
         // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertexData, GL_STATIC_DRAW);
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * indexSize, indexData, GL_STATIC_DRAW);
 
         // set the vertex attribute pointers
         // vertex Positions
@@ -52,39 +52,47 @@ private:
     // loads a model
     void loadModel(string const &path)
     {
+        static_assert(sizeof(Vertex) == sizeof(OBJVertex), "the mesh cache stores vertices in the layout of Vertex");
+        // if the model has been loaded before, its GPU buffers are uploaded straight from the cache file
+        OBJMeshCache cache;
+        if (cache.open(path.c_str()))
+        {
+            const OBJMeshCacheHeader &header = cache.header();
+            meshes.push_back(Mesh(cache.vertexData(), header.vertexCount, cache.indexData(), header.indexCount,
+                                  header.indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT));
+            return;
+        }
 
-        std::vector<glm::vec3> vertices;
-        std::vector<glm::vec2> uvs;
-        std::vector<glm::vec3> normals;
+        // the corners that share the same position, uv and normal are merged in a single vertex
+        std::vector<OBJVertex> vertices;
+        std::vector<unsigned int> indices;
 
-        loadOBJ(path.c_str(), vertices, uvs, normals);
-        meshes.push_back(processMesh(vertices, uvs, normals));
+        if (!loadOBJIndexed(path.c_str(), vertices, indices)) return;
+        writeOBJMeshCache(path.c_str(), vertices, indices);
+        meshes.push_back(processMesh(vertices, indices));
 
     }
 
 
-    Mesh processMesh(const std::vector<glm::vec3> & inVertices,
-                     const std::vector<glm::vec2> & inUvs,
-                     const std::vector<glm::vec3> & inNormals)
+    Mesh processMesh(const std::vector<OBJVertex> & inVertices,
+                     const std::vector<unsigned int> & indices)
     {
         // data to fill
         std::vector<Vertex> vertices;
-        std::vector<unsigned int> indices;
+        vertices.reserve(inVertices.size());
 
         // Walk through each of the mesh's vertices
         for(unsigned int i = 0; i < inVertices.size(); i++)
         {
             Vertex vertex;
-            glm::vec3 vector;
             // positions
-            vertex.Position = inVertices[i];
+            vertex.Position = inVertices[i].position;
             // normals
-            vertex.Normal = inNormals[i];
+            vertex.Normal = inVertices[i].normal;
             // texture coordinates
-            vertex.TexCoords = i < inUvs.size() ? inUvs[i] : glm::vec2(0.0f, 0.0f);
+            vertex.TexCoords = inVertices[i].uv;
 
             vertices.push_back(vertex);
-            indices.push_back(i);
         }
 
         // return a mesh object created from the extracted mesh data
@@ -6,142 +6,466 @@
 
 #include <vector>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <float.h>
 #include <string>
+#include <sstream>
+#include <locale>
 #include <cstring>
+#include <thread>
+#include <algorithm>
+#include <unordered_map>
+#include <memory>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <glm/glm.hpp>
 
-#include "objloader.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define OBJLOADER_MMAP
+#endif
 
 // Very, VERY simple OBJ loader.
 // Here is a short list of features a real function would provide :
 // - Binary files. Reading a model should be just a few memcpy's away, not parsing a file at runtime. In short : OBJ is not very great.
+//   (loadOBJ doesn't, but see OBJMeshCache at the end of the file)
 // - Animations & bones (includes bones weights)
 // - Multiple UVs
 // - All attributes should be optional, not "forced"
 // - More stable. Change a line in the OBJ file and it crashes.
 // - More secure. Change another line and you can inject code.
 // - Loading from memory, stream, etc
+//
+// The file is memory mapped and parsed in place: a first pass counts the records so that the arrays are allocated
+// once, and a second pass tokenizes the lines and converts the numbers with the parsers below. They don't depend
+// on the C locale and are much faster than fscanf, large models are limited by the disk, not by the parser.
+// With more than one thread, the file is split in chunks of complete lines that are parsed in parallel and then
+// concatenated in order, so the result is exactly the same as parsing it with a single thread.
+
+
+// read-only view of the contents of a file, memory mapped when the platform allows it
+class MappedFile {
+public:
+    explicit MappedFile(const char * path){
+#ifdef OBJLOADER_MMAP
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            m_size = size_t(st.st_size);
+            m_ok = true;
+            if (m_size > 0) {
+                void *mapped = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped == MAP_FAILED) m_ok = false;
+                else {
+                    m_data = static_cast<const char*>(mapped);
+                    // we read the file from the beginning to the end
+                    madvise(mapped, m_size, MADV_SEQUENTIAL);
+                }
+            }
+        }
+        close(fd);
+#else
+        FILE * file = fopen(path, "rb");
+        if (file == NULL) return;
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        if (size >= 0) {
+            m_copy.resize(size_t(size));
+            m_ok = fread(m_copy.data(), 1, m_copy.size(), file) == m_copy.size();
+            m_size = m_copy.size();
+            m_data = m_copy.data();
+        }
+        fclose(file);
+#endif
+    }
 
+    ~MappedFile(){
+#ifdef OBJLOADER_MMAP
+        if (m_data) munmap(const_cast<char*>(m_data), m_size);
+#endif
+    }
 
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool isOpen() const { return m_ok; }
+    const char * begin() const { return m_data; }
+    const char * end() const { return m_data + m_size; }
+    size_t size() const { return m_size; }
+
+private:
+    const char * m_data = NULL;
+    size_t m_size = 0;
+    bool m_ok = false;
+#ifndef OBJLOADER_MMAP
+    std::vector<char> m_copy;
+#endif
+};
+
+
+// the contents of an OBJ file, with 1-based indices like in the file
+// (negative indices, relative to the end of the list, are resolved when the file has been read)
+struct OBJData {
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec2> uvs;
+    std::vector<glm::vec3> normals;
+    // three entries per triangle, quads are split in two triangles
+    std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
+};
 
-bool loadOBJ(
-        const char * path,
-        std::vector<float> & out_vertices,
-        std::vector<float> & out_uvs,
-        std::vector<float> & out_normals
-){
-    printf("Loading OBJ file %s...\n", path);
 
-    std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-    std::vector<float> temp_vertices;
-    std::vector<float> temp_uvs;
-    std::vector<float> temp_normals;
+// spaces and tabs separate the tokens of a line
+inline const char * objSkipSpaces(const char * p, const char * end){
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
 
+inline const char * objSkipLine(const char * p, const char * end){
+    const char * newline = (const char *) memchr(p, '\n', end - p);
+    return newline ? newline + 1 : end;
+}
 
-    FILE * file = fopen(path, "r");
-    if( file == NULL ){
-        printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
-        getchar();
-        return false;
+// parses a decimal number ([sign] digits [. digits] [e [sign] digits]) at p, returns false if there is none
+// the digits are accumulated in an integer and scaled by an exact power of ten, which gives the correctly rounded
+// double when the digits fit in 53 bits and the exponent is small (virtually every OBJ file). Rounding that
+// double to float gives the correctly rounded float unless it lies exactly halfway between two floats; those numbers
+// and the uncommon ones are converted by a stream with the classic locale instead
+inline bool objParseFloat(const char * &p, const char * end, float &value){
+    static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const char * start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) { negative = *p == '-'; p++; }
+
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any_digit = false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, any_digit = true) {
+        if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) digits++; }
+        else exponent++; // digits that don't fit only change the magnitude
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, any_digit = true) {
+            if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) digits++; exponent--; }
+        }
+    }
+    if (!any_digit) { p = start; return false; }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char * e = p + 1;
+        bool negative_exponent = false;
+        if (e < end && (*e == '-' || *e == '+')) { negative_exponent = *e == '-'; e++; }
+        if (e < end && *e >= '0' && *e <= '9') {
+            int exp10 = 0;
+            for (; e < end && *e >= '0' && *e <= '9'; e++)
+                if (exp10 < 10000) exp10 = exp10 * 10 + (*e - '0');
+            exponent += negative_exponent ? -exp10 : exp10;
+            p = e;
+        }
+    }
+
+    if (mantissa == 0) {
+        value = negative ? -0.0f : 0.0f;
+        return true;
+    }
+    if (mantissa < (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22) {
+        // one rounding, the mantissa and the power of ten are exact doubles
+        double result = exponent < 0 ? double(mantissa) / powers[-exponent] : double(mantissa) * powers[exponent];
+        // the result is a normal float, so it is halfway between two floats when the 29 low bits of its
+        // mantissa (the ones the float doesn't have) are 1 followed by zeros
+        uint64_t bits;
+        memcpy(&bits, &result, sizeof(bits));
+        if ((bits & ((uint64_t(1) << 29) - 1)) != (uint64_t(1) << 28)) {
+            value = float(negative ? -result : result);
+            return true;
+        }
+    }
+    // the stream doesn't depend on the global locale, and sets the value to 0 or the largest float when it's out of range
+    std::istringstream stream(std::string(start, p));
+    stream.imbue(std::locale::classic());
+    stream >> value;
+    return true;
+}
+
+// marks indices that are relative to the elements read before the face, see objParseIndex
+const unsigned int objRelativeIndex = 0x80000000u;
+
+// parses a face index. A negative index -k refers to the k-th last element read so far; since a thread parsing a
+// chunk doesn't know how many elements the previous chunks have, it is stored as the 1-based index within the chunk
+// (zero or negative if it refers to a previous chunk) in the low 31 bits, marked with objRelativeIndex, and moved to
+// the global range when the chunks are merged (see objResolveIndex)
+inline bool objParseIndex(const char * &p, const char * end, size_t elements_read, unsigned int &value){
+    bool negative = p < end && *p == '-';
+    if (negative) p++;
+    const char * start = p;
+    // indices don't have more digits than this, the accumulation stops before it can overflow
+    uint64_t index = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+        if (index < objRelativeIndex) index = index * 10 + (*p - '0');
+    if (p == start) return false;
+    if (negative) {
+        if (index == 0 || index >= objRelativeIndex / 2) return false;
+        value = (unsigned(elements_read + 1 - index) & ~objRelativeIndex) | objRelativeIndex;
+    }
+    else {
+        // larger positive indices would be read as relative ones
+        if (index >= objRelativeIndex) return false;
+        value = unsigned(index);
+    }
+    return true;
+}
+
+// parses the floats of a v, vt or vn record
+inline bool objParseFloats(const char * &p, const char * end, float * values, int count){
+    for (int i = 0; i < count; i++) {
+        p = objSkipSpaces(p, end);
+        if (!objParseFloat(p, end, values[i])) return false;
+    }
+    return true;
+}
+
+// counts the records of each type, so that the arrays are allocated once
+inline void objCountRecords(const char * p, const char * end, OBJData & data){
+    size_t vertices = 0, uvs = 0, normals = 0, faces = 0;
+    while (p < end) {
+        p = objSkipSpaces(p, end);
+        if (end - p >= 2 && p[0] == 'v') {
+            if (p[1] == ' ' || p[1] == '\t') vertices++;
+            else if (p[1] == 't') uvs++;
+            else if (p[1] == 'n') normals++;
+        }
+        else if (end - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) faces++;
+        p = objSkipLine(p, end);
     }
+    data.vertices.reserve(vertices);
+    data.uvs.reserve(uvs);
+    data.normals.reserve(normals);
+    // we assume triangles, quads make the arrays grow
+    data.vertexIndices.reserve(faces * 3);
+    data.uvIndices.reserve(faces * 3);
+    data.normalIndices.reserve(faces * 3);
+}
+
+// parses the text between begin and end (complete lines) and appends its records to data
+inline bool objParseLines(const char * p, const char * end, OBJData & data){
+    while (p < end) {
+        p = objSkipSpaces(p, end);
+        const char * token = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') p++;
+        size_t length = p - token;
 
-    while( 1 ){
-
-        char lineHeader[128];
-        // read the first word of the line
-        int res = fscanf(file, "%s", lineHeader);
-        if (res == EOF)
-            break; // EOF = End Of File. Quit the loop.
-
-        // else : parse lineHeader
-
-        if ( strcmp( lineHeader, "v" ) == 0 ){
-            float x, y, z;
-            fscanf(file, "%f %f %f\n", &x, &y, &z );
-            temp_vertices.push_back(x);
-            temp_vertices.push_back(y);
-            temp_vertices.push_back(z);
-        }else if ( strcmp( lineHeader, "vt" ) == 0 ){
-            float u, v;
-            fscanf(file, "%f %f\n", &u, &v );
-            v = -v; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
-            temp_uvs.push_back(u);
-            temp_uvs.push_back(v);
-        }else if ( strcmp( lineHeader, "vn" ) == 0 ){
-            float nx, ny, nz;
-            fscanf(file, "%f %f %f\n", &nx, &ny, &nz );
-            temp_normals.push_back(nx);
-            temp_normals.push_back(ny);
-            temp_normals.push_back(nz);
-        }else if ( strcmp( lineHeader, "f" ) == 0 ){
-            std::string vertex1, vertex2, vertex3;
+        if (length == 1 && token[0] == 'v') {
+            glm::vec3 vertex;
+            if (!objParseFloats(p, end, &vertex.x, 3)) return false;
+            data.vertices.push_back(vertex);
+        }else if (length == 2 && token[0] == 'v' && token[1] == 't') {
+            glm::vec2 uv;
+            if (!objParseFloats(p, end, &uv.x, 2)) return false;
+            uv.y = -uv.y; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
+            data.uvs.push_back(uv);
+        }else if (length == 2 && token[0] == 'v' && token[1] == 'n') {
+            glm::vec3 normal;
+            if (!objParseFloats(p, end, &normal.x, 3)) return false;
+            data.normals.push_back(normal);
+        }else if (length == 1 && token[0] == 'f') {
+            // 3 or 4 corners, each one with the vertex/uv/normal indices
             unsigned int vertexIndex[4], uvIndex[4], normalIndex[4];
-            int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n",
-                                 &vertexIndex[0], &uvIndex[0], &normalIndex[0],
-                                 &vertexIndex[1], &uvIndex[1], &normalIndex[1],
-                                 &vertexIndex[2], &uvIndex[2], &normalIndex[2],
-                                 &vertexIndex[3], &uvIndex[3], &normalIndex[3]);
-            if (matches != 9 && matches != 12){
-                printf("File can't be read by our simple parser :-( Try exporting with other options\n");
-                fclose(file);
-                return false;
+            int corners = 0;
+            for (; corners < 4; corners++) {
+                p = objSkipSpaces(p, end);
+                if (p == end || *p == '\n' || *p == '\r') break;
+                if (!objParseIndex(p, end, data.vertices.size(), vertexIndex[corners]) || p == end || *p++ != '/' ||
+                    !objParseIndex(p, end, data.uvs.size(), uvIndex[corners]) || p == end || *p++ != '/' ||
+                    !objParseIndex(p, end, data.normals.size(), normalIndex[corners]))
+                    return false;
             }
-            // triangle info
-            vertexIndices.push_back(vertexIndex[0]);
-            vertexIndices.push_back(vertexIndex[1]);
-            vertexIndices.push_back(vertexIndex[2]);
-            uvIndices    .push_back(uvIndex[0]);
-            uvIndices    .push_back(uvIndex[1]);
-            uvIndices    .push_back(uvIndex[2]);
-            normalIndices.push_back(normalIndex[0]);
-            normalIndices.push_back(normalIndex[1]);
-            normalIndices.push_back(normalIndex[2]);
-            if (matches == 12){
-                // if a quad is defined, load as a second triangle
-                vertexIndices.push_back(vertexIndex[0]);
-                vertexIndices.push_back(vertexIndex[2]);
-                vertexIndices.push_back(vertexIndex[3]);
-                uvIndices    .push_back(uvIndex[0]);
-                uvIndices    .push_back(uvIndex[2]);
-                uvIndices    .push_back(uvIndex[3]);
-                normalIndices.push_back(normalIndex[0]);
-                normalIndices.push_back(normalIndex[2]);
-                normalIndices.push_back(normalIndex[3]);
+            if (corners < 3) return false;
+
+            static const int triangles[2][3] = {{0, 1, 2}, {0, 2, 3}};
+            for (int t = 0; t < corners - 2; t++) {
+                for (int c : triangles[t]) {
+                    data.vertexIndices.push_back(vertexIndex[c]);
+                    data.uvIndices    .push_back(uvIndex[c]);
+                    data.normalIndices.push_back(normalIndex[c]);
+                }
             }
-        }else{
-            // Probably a comment, eat up the rest of the line
-            char stupidBuffer[1000];
-            fgets(stupidBuffer, 1000, file);
         }
+        // anything else is probably a comment, the rest of the line is skipped
+        p = objSkipLine(p, end);
+    }
+    return true;
+}
+
+// calls task(i) for every i in [0, count) using up to thread_count threads, each thread gets a contiguous range
+template <class Task>
+void objParallelFor(size_t count, unsigned int thread_count, const Task & task){
+    thread_count = (unsigned int) std::max<size_t>(1, std::min<size_t>(thread_count, count));
+    std::vector<std::thread> threads;
+    for (unsigned int t = 1; t < thread_count; t++)
+        threads.emplace_back([&, t](){
+            for (size_t i = count * t / thread_count; i < count * (t + 1) / thread_count; i++) task(i);
+        });
+    for (size_t i = 0; i < count / thread_count; i++) task(i);
+    for (auto & thread : threads) thread.join();
+}
+
+inline unsigned int objThreadCount(unsigned int threads){
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    return threads == 0 ? 1 : threads;
+}
+
+// offset is the number of elements of the previous chunks, indices that end up out of range are left
+// to objValidIndices (0 is never valid)
+inline unsigned int objResolveIndex(unsigned int index, size_t offset){
+    if (!(index & objRelativeIndex)) return index;
+    // sign extension of the low 31 bits
+    long long local = (long long)(index & ~objRelativeIndex) - (long long)(index & (objRelativeIndex >> 1)) * 2;
+    long long global = local + (long long) offset;
+    return global > 0 && global < (long long) objRelativeIndex ? unsigned(global) : 0;
+}
+
+// copies the indices of a chunk to their place in the merged array, resolving the relative ones
+inline void objAppendIndices(std::vector<unsigned int> & out, size_t first, const std::vector<unsigned int> & chunk, size_t offset){
+    for (size_t i = 0; i < chunk.size(); i++)
+        out[first + i] = objResolveIndex(chunk[i], offset);
+}
+
+// parses the file in chunks of complete lines, one per thread, and merges them in order:
+// a prefix sum of the element counts of the chunks gives where each chunk goes in the arrays
+// and the offset of its relative indices
+inline bool objParseParallel(const char * begin, const char * end, unsigned int thread_count, OBJData & data){
+    if (thread_count <= 1) {
+        // a single chunk is parsed in place, only its relative indices need to be resolved
+        objCountRecords(begin, end, data);
+        if (!objParseLines(begin, end, data)) return false;
+        for (std::vector<unsigned int> * indices : {&data.vertexIndices, &data.uvIndices, &data.normalIndices})
+            for (unsigned int & index : *indices) index = objResolveIndex(index, 0);
+        return true;
+    }
+
+    std::vector<const char *> bounds(thread_count + 1, end);
+    bounds[0] = begin;
+    for (unsigned int c = 1; c < thread_count; c++) {
+        const char * p = std::max(bounds[c - 1], begin + (end - begin) / thread_count * c);
+        bounds[c] = p > begin && p < end && p[-1] != '\n' ? objSkipLine(p, end) : p;
+    }
+
+    std::vector<OBJData> chunks(thread_count);
+    std::vector<char> ok(thread_count, 0);
+    objParallelFor(thread_count, thread_count, [&](size_t c){
+        objCountRecords(bounds[c], bounds[c + 1], chunks[c]);
+        ok[c] = objParseLines(bounds[c], bounds[c + 1], chunks[c]);
+    });
+    for (char chunk_ok : ok) if (!chunk_ok) return false;
+
+    // prefix sums, where every chunk starts in the merged arrays
+    std::vector<size_t> vertex_start(thread_count + 1, 0), uv_start(thread_count + 1, 0),
+                        normal_start(thread_count + 1, 0), index_start(thread_count + 1, 0);
+    for (unsigned int c = 0; c < thread_count; c++) {
+        vertex_start[c + 1] = vertex_start[c] + chunks[c].vertices.size();
+        uv_start[c + 1] = uv_start[c] + chunks[c].uvs.size();
+        normal_start[c + 1] = normal_start[c] + chunks[c].normals.size();
+        index_start[c + 1] = index_start[c] + chunks[c].vertexIndices.size();
+    }
+    data.vertices.resize(vertex_start[thread_count]);
+    data.uvs.resize(uv_start[thread_count]);
+    data.normals.resize(normal_start[thread_count]);
+    data.vertexIndices.resize(index_start[thread_count]);
+    data.uvIndices.resize(index_start[thread_count]);
+    data.normalIndices.resize(index_start[thread_count]);
+
+    objParallelFor(thread_count, thread_count, [&](size_t c){
+        const OBJData & chunk = chunks[c];
+        std::copy(chunk.vertices.begin(), chunk.vertices.end(), data.vertices.begin() + vertex_start[c]);
+        std::copy(chunk.uvs.begin(), chunk.uvs.end(), data.uvs.begin() + uv_start[c]);
+        std::copy(chunk.normals.begin(), chunk.normals.end(), data.normals.begin() + normal_start[c]);
+        objAppendIndices(data.vertexIndices, index_start[c], chunk.vertexIndices, vertex_start[c]);
+        objAppendIndices(data.uvIndices, index_start[c], chunk.uvIndices, uv_start[c]);
+        objAppendIndices(data.normalIndices, index_start[c], chunk.normalIndices, normal_start[c]);
+    });
+    return true;
+}
 
+// true if every index refers to an existing element (indices start at 1)
+inline bool objValidIndices(const OBJData & data){
+    for (size_t i = 0; i < data.vertexIndices.size(); i++) {
+        if (data.vertexIndices[i] - 1 >= data.vertices.size() ||
+            data.uvIndices[i] - 1 >= data.uvs.size() ||
+            data.normalIndices[i] - 1 >= data.normals.size())
+            return false;
     }
+    return true;
+}
 
-    // For each vertex of each triangle
-    for( unsigned int i=0; i<vertexIndices.size(); i++ ){
-
-        // Get the indices of its attributes
-        unsigned int vertexIndex = vertexIndices[i];
-        unsigned int uvIndex = uvIndices[i];
-        unsigned int normalIndex = normalIndices[i];
-
-        // Get the attributes thanks to the index
-        float x = temp_vertices[ (vertexIndex-1) * 3 ];
-        float y = temp_vertices[ (vertexIndex-1) * 3 +1 ];
-        float z = temp_vertices[ (vertexIndex-1) * 3 +2 ];
-        float u = temp_uvs[ (uvIndex-1) * 2 ];
-        float v = temp_uvs[ (uvIndex-1) * 2 +1 ];
-        float nx = temp_normals[ (normalIndex-1) * 3 ];
-        float ny = temp_normals[ (normalIndex-1) * 3 +1 ];
-        float nz = temp_normals[ (normalIndex-1) * 3 +2 ];
-
-        // Put the attributes in buffers
-        out_vertices.push_back(x); out_vertices.push_back(y); out_vertices.push_back(z);
-        out_uvs.push_back(u); out_uvs.push_back(v);
-        out_normals.push_back(nx); out_normals.push_back(ny); out_normals.push_back(nz);
+// reads the records of an OBJ file, returns false if the file can't be opened or read by our simple parser
+// threads == 0 uses all cores, small files are always read by a single thread
+inline bool parseOBJ(const char * path, OBJData & data, unsigned int threads = 0){
+    MappedFile file(path);
+    if (!file.isOpen()) {
+        printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
+        getchar();
+        return false;
+    }
 
+    // below this size, starting the threads costs more than what they save
+    const size_t min_chunk_size = 1 << 20;
+    unsigned int thread_count = (unsigned int) std::max<size_t>(1, std::min<size_t>(objThreadCount(threads), file.size() / min_chunk_size));
+    if (!objParseParallel(file.begin(), file.end(), thread_count, data) || !objValidIndices(data)) {
+        printf("File can't be read by our simple parser :-( Try exporting with other options\n");
+        return false;
     }
-    fclose(file);
+    return true;
+}
+
+
+
+// the output arrays are resized first, then every thread fills a range of vertices
+// threads == 0 uses all cores
+bool loadOBJ(
+        const char * path,
+        std::vector<float> & out_vertices,
+        std::vector<float> & out_uvs,
+        std::vector<float> & out_normals,
+        unsigned int threads = 0
+){
+    printf("Loading OBJ file %s...\n", path);
+
+    OBJData data;
+    if (!parseOBJ(path, data, threads)) return false;
+
+    size_t count = data.vertexIndices.size();
+    out_vertices.resize(out_vertices.size() + count * 3);
+    out_uvs     .resize(out_uvs.size() + count * 2);
+    out_normals .resize(out_normals.size() + count * 3);
+    float * vertices = out_vertices.data() + out_vertices.size() - count * 3;
+    float * uvs      = out_uvs.data() + out_uvs.size() - count * 2;
+    float * normals  = out_normals.data() + out_normals.size() - count * 3;
+
+    const size_t block_size = 1 << 16;
+    size_t blocks = (count + block_size - 1) / block_size;
+    objParallelFor(blocks, objThreadCount(threads), [&](size_t block){
+        // For each vertex of each triangle
+        for( size_t i=block * block_size; i<std::min(count, (block + 1) * block_size); i++ ){
+
+            // Get the attributes thanks to the index
+            const glm::vec3 & vertex = data.vertices[ data.vertexIndices[i]-1 ];
+            const glm::vec2 & uv = data.uvs[ data.uvIndices[i]-1 ];
+            const glm::vec3 & normal = data.normals[ data.normalIndices[i]-1 ];
+
+            // Put the attributes in buffers
+            vertices[i * 3] = vertex.x; vertices[i * 3 + 1] = vertex.y; vertices[i * 3 + 2] = vertex.z;
+            uvs[i * 2] = uv.x; uvs[i * 2 + 1] = uv.y;
+            normals[i * 3] = normal.x; normals[i * 3 + 1] = normal.y; normals[i * 3 + 2] = normal.z;
+
+        }
+    });
     return true;
 }
 
@@ -151,110 +475,246 @@ bool loadOBJ(
         const char * path,
         std::vector<glm::vec3> & out_vertices,
         std::vector<glm::vec2> & out_uvs,
-        std::vector<glm::vec3> & out_normals
+        std::vector<glm::vec3> & out_normals,
+        unsigned int threads = 0
 ){
     printf("Loading OBJ file %s...\n", path);
 
-    std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-    std::vector<glm::vec3> temp_vertices;
-    std::vector<glm::vec2> temp_uvs;
-    std::vector<glm::vec3> temp_normals;
+    OBJData data;
+    if (!parseOBJ(path, data, threads)) return false;
 
+    size_t count = data.vertexIndices.size();
+    out_vertices.resize(out_vertices.size() + count);
+    out_uvs     .resize(out_uvs.size() + count);
+    out_normals .resize(out_normals.size() + count);
+    glm::vec3 * vertices = out_vertices.data() + out_vertices.size() - count;
+    glm::vec2 * uvs = out_uvs.data() + out_uvs.size() - count;
+    glm::vec3 * normals = out_normals.data() + out_normals.size() - count;
 
-    FILE * file = fopen(path, "r");
-    if( file == NULL ){
-        printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
-        getchar();
-        return false;
-    }
+    const size_t block_size = 1 << 16;
+    size_t blocks = (count + block_size - 1) / block_size;
+    objParallelFor(blocks, objThreadCount(threads), [&](size_t block){
+        // For each vertex of each triangle
+        for( size_t i=block * block_size; i<std::min(count, (block + 1) * block_size); i++ ){
 
-    while( 1 ){
+            // Put the attributes in buffers
+            vertices[i] = data.vertices[ data.vertexIndices[i]-1 ];
+            uvs[i]      = data.uvs[ data.uvIndices[i]-1 ];
+            normals[i]  = data.normals[ data.normalIndices[i]-1 ];
 
-        char lineHeader[128];
-        // read the first word of the line
-        int res = fscanf(file, "%s", lineHeader);
-        if (res == EOF)
-            break; // EOF = End Of File. Quit the loop.
+        }
+    });
+    return true;
+}
 
-        // else : parse lineHeader
 
-        if ( strcmp( lineHeader, "v" ) == 0 ){
-            glm::vec3 vertex;
-            fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z );
-            temp_vertices.push_back(vertex);
-        }else if ( strcmp( lineHeader, "vt" ) == 0 ){
-            glm::vec2 uv;
-            fscanf(file, "%f %f\n", &uv.x, &uv.y );
-            uv.y = -uv.y; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
-            temp_uvs.push_back(uv);
-        }else if ( strcmp( lineHeader, "vn" ) == 0 ){
-            glm::vec3 normal;
-            fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z );
-            temp_normals.push_back(normal);
-        }else if ( strcmp( lineHeader, "f" ) == 0 ){
-            unsigned int vertexIndex[4], uvIndex[4], normalIndex[4];
-            int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n",
-                                 &vertexIndex[0], &uvIndex[0], &normalIndex[0],
-                                 &vertexIndex[1], &uvIndex[1], &normalIndex[1],
-                                 &vertexIndex[2], &uvIndex[2], &normalIndex[2],
-                                 &vertexIndex[3], &uvIndex[3], &normalIndex[3]);
-            if (matches != 9 && matches != 12){
-                printf("File can't be read by our simple parser :-( Try exporting with other options\n");
-                fclose(file);
-                return false;
-            }
-            vertexIndices.push_back(vertexIndex[0]);
-            vertexIndices.push_back(vertexIndex[1]);
-            vertexIndices.push_back(vertexIndex[2]);
-            uvIndices    .push_back(uvIndex[0]);
-            uvIndices    .push_back(uvIndex[1]);
-            uvIndices    .push_back(uvIndex[2]);
-            normalIndices.push_back(normalIndex[0]);
-            normalIndices.push_back(normalIndex[1]);
-            normalIndices.push_back(normalIndex[2]);
-
-            if (matches == 12){
-                // if a quad is defined, load as a second triangle
-                vertexIndices.push_back(vertexIndex[0]);
-                vertexIndices.push_back(vertexIndex[2]);
-                vertexIndices.push_back(vertexIndex[3]);
-                uvIndices    .push_back(uvIndex[0]);
-                uvIndices    .push_back(uvIndex[2]);
-                uvIndices    .push_back(uvIndex[3]);
-                normalIndices.push_back(normalIndex[0]);
-                normalIndices.push_back(normalIndex[2]);
-                normalIndices.push_back(normalIndex[3]);
-            }
-        }else{
-            // Probably a comment, eat up the rest of the line
-            char stupidBuffer[1000];
-            fgets(stupidBuffer, 1000, file);
-        }
 
+// a vertex of an indexed mesh, same layout as the Vertex struct of mesh.h
+struct OBJVertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 uv;
+};
+
+// a face corner, the (v, vt, vn) indices used as key to find the corners that share a vertex
+struct OBJCorner {
+    unsigned int vertex, uv, normal;
+    bool operator==(const OBJCorner & other) const {
+        return vertex == other.vertex && uv == other.uv && normal == other.normal;
+    }
+};
+
+struct OBJCornerHash {
+    size_t operator()(const OBJCorner & c) const {
+        uint64_t h = (uint64_t(c.vertex) * 0x9E3779B97F4A7C15ull) ^ (uint64_t(c.uv) * 0xC2B2AE3D27D4EB4Full) ^ (uint64_t(c.normal) * 0x165667B19E3779F9ull);
+        return size_t(h ^ (h >> 32));
+    }
+};
+
+// loads an OBJ file as an indexed mesh: corners with the same (v, vt, vn) indices become a single vertex, so that
+// the mesh can be drawn with glDrawElements and the GPU can reuse the vertex shader results of shared vertices.
+// Vertices are appended to out_vertices (in the order of their first use) and out_indices refers to them,
+// three indices per triangle
+bool loadOBJIndexed(
+        const char * path,
+        std::vector<OBJVertex> & out_vertices,
+        std::vector<unsigned int> & out_indices,
+        unsigned int threads = 0
+){
+    printf("Loading OBJ file %s...\n", path);
+
+    OBJData data;
+    if (!parseOBJ(path, data, threads)) return false;
+
+    size_t count = data.vertexIndices.size();
+    // a closed triangle mesh has about half as many vertices as triangles, seams add a few more
+    std::unordered_map<OBJCorner, unsigned int, OBJCornerHash> unique;
+    unique.reserve(std::max(data.vertices.size(), count / 6));
+    out_indices.reserve(out_indices.size() + count);
+
+    for (size_t i = 0; i < count; i++) {
+        OBJCorner corner = {data.vertexIndices[i], data.uvIndices[i], data.normalIndices[i]};
+        auto inserted = unique.insert(std::make_pair(corner, (unsigned int) out_vertices.size()));
+        if (inserted.second) {
+            OBJVertex vertex;
+            vertex.position = data.vertices[corner.vertex - 1];
+            vertex.normal = data.normals[corner.normal - 1];
+            vertex.uv = data.uvs[corner.uv - 1];
+            out_vertices.push_back(vertex);
+        }
+        out_indices.push_back(inserted.first->second);
     }
+    return true;
+}
+
+
 
-    // For each vertex of each triangle
-    for( unsigned int i=0; i<vertexIndices.size(); i++ ){
+// Binary mesh cache. The first time an OBJ file is loaded as an indexed mesh, the result is written to a file next
+// to it (model.obj -> model.obj.mesh) in the layout the GPU wants: a header, the interleaved vertices and the
+// index buffer. The next runs map the cache file and upload the two blocks as they are, without parsing anything.
+// The header identifies the OBJ file it was made from, so a cache is ignored (and rewritten) when the OBJ changes
+//
+// the file layout is:
+//   OBJMeshCacheHeader
+//   vertexCount * vertexStride bytes of vertices, at vertexOffset
+//   indexCount * indexSize bytes of indices, at indexOffset
+// both offsets are multiples of 16
+
+// increase when the layout of the file or of OBJVertex change, old cache files are then ignored
+const uint32_t objMeshCacheVersion = 1;
+
+struct OBJMeshCacheAttribute {
+    uint32_t components;    // number of floats
+    uint32_t offset;        // in bytes, from the start of the vertex
+};
+
+struct OBJMeshCacheHeader {
+    char magic[4];                          // "OBJM"
+    uint32_t version;                       // objMeshCacheVersion
+    uint64_t sourceHash;                    // see objSourceHash
+    uint32_t vertexCount, vertexStride;
+    uint32_t indexCount, indexSize;         // indexSize is 2 for meshes with up to 65536 vertices, 4 otherwise
+    // position, normal and uv, in this order
+    OBJMeshCacheAttribute attributes[3];
+    float boundsMin[3], boundsMax[3];
+    uint64_t vertexOffset, indexOffset;
+};
+
+// identifies the contents of the OBJ file: hash of its size and modification time.
+// Hashing the contents would take longer than loading the cache, returns 0 if the file doesn't exist
+inline uint64_t objSourceHash(const char * path){
+    struct stat st;
+    if (stat(path, &st) != 0) return 0;
+    uint64_t words[2] = {uint64_t(st.st_size), uint64_t(st.st_mtime)};
+    uint64_t hash = 14695981039346656037ull;
+    for (uint64_t w : words)
+        for (int byte = 0; byte < 8; byte++) hash = (hash ^ ((w >> (byte * 8)) & 0xFF)) * 1099511628211ull;
+    return hash == 0 ? 1 : hash;
+}
 
-        // Get the indices of its attributes
-        unsigned int vertexIndex = vertexIndices[i];
-        unsigned int uvIndex = uvIndices[i];
-        unsigned int normalIndex = normalIndices[i];
+inline std::string objMeshCachePath(const char * obj_path){
+    return std::string(obj_path) + ".mesh";
+}
 
-        // Get the attributes thanks to the index
-        glm::vec3 vertex = temp_vertices[ vertexIndex-1 ];
-        glm::vec2 uv = temp_uvs[ uvIndex-1 ];
-        glm::vec3 normal = temp_normals[ normalIndex-1 ];
+// the header a cache of the given mesh would have, everything but the bounds
+inline OBJMeshCacheHeader objMeshCacheHeader(uint64_t source_hash, size_t vertex_count, size_t index_count){
+    OBJMeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "OBJM", 4);
+    header.version = objMeshCacheVersion;
+    header.sourceHash = source_hash;
+    header.vertexCount = uint32_t(vertex_count);
+    header.vertexStride = sizeof(OBJVertex);
+    header.indexCount = uint32_t(index_count);
+    header.indexSize = vertex_count <= 65536 ? 2 : 4;
+    header.attributes[0] = {3, uint32_t(offsetof(OBJVertex, position))};
+    header.attributes[1] = {3, uint32_t(offsetof(OBJVertex, normal))};
+    header.attributes[2] = {2, uint32_t(offsetof(OBJVertex, uv))};
+    header.vertexOffset = (sizeof(OBJMeshCacheHeader) + 15) / 16 * 16;
+    header.indexOffset = (header.vertexOffset + uint64_t(vertex_count) * sizeof(OBJVertex) + 15) / 16 * 16;
+    return header;
+}
 
-        // Put the attributes in buffers
-        out_vertices.push_back(vertex);
-        out_uvs     .push_back(uv);
-        out_normals .push_back(normal);
+// writes the cache of an OBJ file, returns false if it could not be written (e.g. a read-only directory)
+inline bool writeOBJMeshCache(const char * obj_path, const std::vector<OBJVertex> & vertices, const std::vector<unsigned int> & indices){
+    uint64_t source_hash = objSourceHash(obj_path);
+    if (source_hash == 0) return false;
 
+    OBJMeshCacheHeader header = objMeshCacheHeader(source_hash, vertices.size(), indices.size());
+    glm::vec3 lo(vertices.empty() ? 0.0f : FLT_MAX), hi(vertices.empty() ? 0.0f : -FLT_MAX);
+    for (const OBJVertex & v : vertices) {
+        lo = glm::min(lo, v.position);
+        hi = glm::max(hi, v.position);
+    }
+    memcpy(header.boundsMin, &lo.x, sizeof(header.boundsMin));
+    memcpy(header.boundsMax, &hi.x, sizeof(header.boundsMax));
+
+    std::vector<char> file(header.indexOffset + uint64_t(indices.size()) * header.indexSize, 0);
+    memcpy(file.data(), &header, sizeof(header));
+    if (!vertices.empty()) memcpy(file.data() + header.vertexOffset, vertices.data(), vertices.size() * sizeof(OBJVertex));
+    if (header.indexSize == 2) {
+        uint16_t * out = reinterpret_cast<uint16_t *>(file.data() + header.indexOffset);
+        for (size_t i = 0; i < indices.size(); i++) out[i] = uint16_t(indices[i]);
+    }
+    else if (!indices.empty())
+        memcpy(file.data() + header.indexOffset, indices.data(), indices.size() * sizeof(unsigned int));
+
+    // we write to a temporary file and rename it, so that a program loading the cache never sees a half written file
+    std::string name = objMeshCachePath(obj_path), temp_name = name + ".tmp";
+    FILE * out = fopen(temp_name.c_str(), "wb");
+    if (out == NULL) return false;
+    bool written = fwrite(file.data(), 1, file.size(), out) == file.size();
+    written = fclose(out) == 0 && written;
+    // rename doesn't replace existing files on every platform
+    remove(name.c_str());
+    if (!written || rename(temp_name.c_str(), name.c_str()) != 0) {
+        remove(temp_name.c_str());
+        return false;
     }
-    fclose(file);
     return true;
 }
 
+// the cache file of an OBJ file, mapped in memory. The vertex and index blocks can be given to glBufferData as they are
+class OBJMeshCache {
+public:
+    // returns false if there is no cache for the OBJ file, or if it is not valid (different OBJ file, layout or version)
+    bool open(const char * obj_path){
+        m_file.reset();
+        uint64_t source_hash = objSourceHash(obj_path);
+        if (source_hash == 0) return false;
+        std::unique_ptr<MappedFile> file(new MappedFile(objMeshCachePath(obj_path).c_str()));
+        if (!file->isOpen() || file->size() < sizeof(OBJMeshCacheHeader)) return false;
+
+        memcpy(&m_header, file->begin(), sizeof(m_header));
+        // everything but the bounds must be what we would write for a mesh of this size
+        OBJMeshCacheHeader expected = objMeshCacheHeader(source_hash, m_header.vertexCount, m_header.indexCount);
+        memcpy(expected.boundsMin, m_header.boundsMin, sizeof(expected.boundsMin));
+        memcpy(expected.boundsMax, m_header.boundsMax, sizeof(expected.boundsMax));
+        if (memcmp(&expected, &m_header, sizeof(m_header)) != 0) return false;
+        if (file->size() != m_header.indexOffset + uint64_t(m_header.indexCount) * m_header.indexSize) return false;
+
+        // a corrupted file must not make the GPU read vertices that don't exist
+        const char * index_data = file->begin() + m_header.indexOffset;
+        for (uint32_t i = 0; i < m_header.indexCount; i++) {
+            uint32_t index;
+            if (m_header.indexSize == 2) { uint16_t index16; memcpy(&index16, index_data + i * 2, 2); index = index16; }
+            else memcpy(&index, index_data + i * 4, 4);
+            if (index >= m_header.vertexCount) return false;
+        }
+
+        m_file = std::move(file);
+        return true;
+    }
+
+    bool isOpen() const { return m_file != nullptr; }
+    const OBJMeshCacheHeader & header() const { return m_header; }
+    const void * vertexData() const { return m_file->begin() + m_header.vertexOffset; }
+    const void * indexData() const { return m_file->begin() + m_header.indexOffset; }
+
+private:
+    std::unique_ptr<MappedFile> m_file;
+    OBJMeshCacheHeader m_header;
+};
+
 
 #endif //GRAPHICSPROGRAMMINGEXERCISES_OBJLOADER_H
@@ -134,14 +134,16 @@ int main()
 
 
     carShader = new Shader("shaders/car_shader.vert", "shaders/car_shader.frag");
+    MaterialTable::setupSamplers(*carShader);
     floorShader = new Shader("shaders/floor_Shader.vert", "shaders/floor_Shader.frag");
-	carPaint = new Model("car/Paint_LOD0.obj");
-	carBody = new Model("car/Body_LOD0.obj");
-	carLight = new Model("car/Light_LOD0.obj");
-	carInterior = new Model("car/Interior_LOD0.obj");
-	carWindow = new Model("car/Windows_LOD0.obj");
-	carWheel = new Model("car/Wheel_LOD0.obj");
-	floorModel = new Model("floor/floor_no_material.obj");
+	// batched, with packed vertices and without CPU copies of the meshes (both shaders unpack the vertices)
+	carPaint = new Model("car/Paint_LOD0.obj", false, true, false, true);
+	carBody = new Model("car/Body_LOD0.obj", false, true, false, true);
+	carLight = new Model("car/Light_LOD0.obj", false, true, false, true);
+	carInterior = new Model("car/Interior_LOD0.obj", false, true, false, true);
+	carWindow = new Model("car/Windows_LOD0.obj", false, true, false, true);
+	carWheel = new Model("car/Wheel_LOD0.obj", false, true, false, true);
+	floorModel = new Model("floor/floor_no_material.obj", false, true, false, true);
 
     // set up the z-buffer
     glDepthRange(-1,1); // make the NDC a right handed coordinate system, with the camera pointing towards -z
@@ -174,6 +176,9 @@ int main()
 
         processInput(window);
 
+        // replace the placeholders of the model textures that have been decoded in the background
+        TextureCache::instance().update();
+
         glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -388,6 +393,7 @@ void drawCar(){
     glm::mat4 invTranspose = glm::inverse(glm::transpose(view * model));
     carShader->setMat4("invTranspMV", invTranspose);
     carShader->setMat4("view", view);
+    carWheel->SelectLOD(model, camera, SCR_HEIGHT);
     carWheel->Draw(*carShader);
 
     // draw wheel
@@ -396,6 +402,7 @@ void drawCar(){
     invTranspose = glm::inverse(glm::transpose(view * model));
     carShader->setMat4("invTranspMV", invTranspose);
     carShader->setMat4("view", view);
+    carWheel->SelectLOD(model, camera, SCR_HEIGHT);
     carWheel->Draw(*carShader);
 
     // draw wheel
@@ -405,6 +412,7 @@ void drawCar(){
     invTranspose = glm::inverse(glm::transpose(view * model));
     carShader->setMat4("invTranspMV", invTranspose);
     carShader->setMat4("view", view);
+    carWheel->SelectLOD(model, camera, SCR_HEIGHT);
     carWheel->Draw(*carShader);
 
     // draw wheel
@@ -414,6 +422,7 @@ void drawCar(){
     invTranspose = glm::inverse(glm::transpose(view * model));
     carShader->setMat4("invTranspMV", invTranspose);
     carShader->setMat4("view", view);
+    carWheel->SelectLOD(model, camera, SCR_HEIGHT);
     carWheel->Draw(*carShader);
 
     // draw the rest of the car
@@ -422,10 +431,15 @@ void drawCar(){
     invTranspose = glm::inverse(glm::transpose(view * model));
     carShader->setMat4("invTranspMV", invTranspose);
     carShader->setMat4("view", view);
+    carBody->SelectLOD(model, camera, SCR_HEIGHT);
     carBody->Draw(*carShader);
+    carInterior->SelectLOD(model, camera, SCR_HEIGHT);
     carInterior->Draw(*carShader);
+    carPaint->SelectLOD(model, camera, SCR_HEIGHT);
     carPaint->Draw(*carShader);
+    carLight->SelectLOD(model, camera, SCR_HEIGHT);
     carLight->Draw(*carShader);
+    carWindow->SelectLOD(model, camera, SCR_HEIGHT);
     glEnable(GL_BLEND);
     carWindow->Draw(*carShader);
     glDisable(GL_BLEND);
@@ -0,0 +1,316 @@
+#ifndef MATERIAL_TABLE_H
+#define MATERIAL_TABLE_H
+
+#include <glad/glad.h>
+
+#include <mesh.h>
+#include <shader.h>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <algorithm>
+using namespace std;
+
+// The textures of all the materials of a model, packed in one texture array per type of texture (diffuse, specular,
+// normal and ambient), so that the whole model can be drawn with the same texture bindings.
+//
+// Every material is a row of the table with the layer of each of its textures (-1 if it doesn't have one of that
+// type), the shader gets the table as the uniform array 'materialLayers' and the material of each vertex as a vertex
+// attribute. The layers of an array must have the same size, so build fails if the textures of a type have different
+// sizes, and the model has to keep binding its textures per material.
+//
+// The arrays are copies of the textures, models get their tables from MaterialTableCache so that the models with the
+// same materials share one copy.
+class MaterialTable
+{
+public:
+    // the types of textures, in the order of the components of materialLayers
+    static const unsigned int slotCount = 4;
+    // must match the size of materialLayers in the shaders
+    static const unsigned int maxMaterials = 64;
+
+    MaterialTable() = default;
+    MaterialTable(const MaterialTable&) = delete;
+    MaterialTable& operator=(const MaterialTable&) = delete;
+
+    ~MaterialTable()
+    {
+        for (unsigned int slot = 0; slot < slotCount; slot++)
+            if (arrays[slot])
+                glDeleteTextures(1, &arrays[slot]);
+    }
+
+    bool ready() const { return built; }
+
+    // copies the textures of the materials to the texture arrays, the first texture of each type is used
+    // (the one the shaders sample as texture_diffuse1, texture_normal1...). The textures must have been loaded
+    bool build(const vector<vector<Texture>> &materials)
+    {
+        if (materials.empty() || materials.size() > maxMaterials)
+            return false;
+
+        // the distinct textures of each type, and the layer each material uses
+        vector<unsigned int> slotTextures[slotCount];
+        layers.assign(materials.size() * slotCount, -1);
+        for (unsigned int m = 0; m < materials.size(); m++)
+        {
+            for (unsigned int slot = 0; slot < slotCount; slot++)
+            {
+                const Texture *texture = firstOfType(materials[m], slotTypes()[slot]);
+                if (!texture)
+                    continue;
+                vector<unsigned int> &textures = slotTextures[slot];
+                unsigned int layer = 0;
+                while (layer < textures.size() && textures[layer] != texture->id)
+                    layer++;
+                if (layer == textures.size())
+                    textures.push_back(texture->id);
+                layers[m * slotCount + slot] = layer;
+            }
+        }
+
+        // all the textures of a type must have the same size
+        GLint width[slotCount] = {}, height[slotCount] = {};
+        for (unsigned int slot = 0; slot < slotCount; slot++)
+        {
+            for (unsigned int i = 0; i < slotTextures[slot].size(); i++)
+            {
+                GLint w, h;
+                glBindTexture(GL_TEXTURE_2D, slotTextures[slot][i]);
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+                if (i > 0 && (w != width[slot] || h != height[slot]))
+                    return false;
+                width[slot] = w;
+                height[slot] = h;
+            }
+        }
+
+        // the textures are copied through a pixel buffer, so the data stays on the GPU and we don't wait for it
+        unsigned int staging;
+        glGenBuffers(1, &staging);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, staging);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        for (unsigned int slot = 0; slot < slotCount; slot++)
+        {
+            const vector<unsigned int> &textures = slotTextures[slot];
+            if (textures.empty())
+                continue;
+            glGenTextures(1, &arrays[slot]);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[slot]);
+
+            GLenum format = compressedFormat(textures, width[slot], height[slot]);
+            if (format)
+                copyCompressed(textures, format, width[slot], height[slot], staging);
+            else
+            {
+                // the textures are read back as RGBA, which is also how the shaders see single channel textures (r, 0, 0, 1)
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width[slot], height[slot], textures.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+                glBufferData(GL_PIXEL_PACK_BUFFER, size_t(width[slot]) * height[slot] * 4, NULL, GL_STREAM_COPY);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging);
+                for (unsigned int layer = 0; layer < textures.size(); layer++)
+                {
+                    glBindTexture(GL_TEXTURE_2D, textures[layer]);
+                    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width[slot], height[slot], 1, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+                }
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+            }
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glDeleteBuffers(1, &staging);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        built = true;
+        return true;
+    }
+
+    // texture units of the arrays, firstUnit, firstUnit + 1... They come after the units of the sampler2D uniforms of
+    // the shaders, a unit can't be sampled with two types of sampler
+    static const unsigned int firstUnit = 4;
+
+    // points the array samplers of a shader to their units, once after the shader is created. Until then they sample
+    // unit 0 like the sampler2D uniforms, and GL refuses to draw with the shader, whether the model uses a table or not
+    static void setupSamplers(Shader &shader)
+    {
+        shader.use();
+        for (unsigned int slot = 0; slot < slotCount; slot++)
+            shader.setInt(shader.uniform<int>(slotTypes()[slot] + "_array"), firstUnit + slot);
+    }
+
+    // binds the arrays to their texture units and sets the table of the shader (see setupSamplers)
+    void bind(Shader &shader)
+    {
+        const Uniforms &u = uniforms(shader);
+        for (unsigned int slot = 0; slot < slotCount; slot++)
+        {
+            glActiveTexture(GL_TEXTURE0 + firstUnit + slot);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[slot]);
+        }
+        shader.setIVec4Array(u.layers, layers.data(), layers.size() / slotCount);
+        shader.setBool(u.useMaterialTable, true);
+    }
+
+private:
+    bool built = false;
+    unsigned int arrays[slotCount] = {};
+    vector<GLint> layers;   // slotCount layers per material
+
+    // uniforms of the last shader we have been used with
+    struct Uniforms
+    {
+        unsigned int shaderID = 0;
+        Shader::Uniform<glm::ivec4> layers;
+        Shader::Uniform<bool> useMaterialTable;
+    } cachedUniforms;
+
+    const Uniforms &uniforms(const Shader &shader)
+    {
+        if (cachedUniforms.shaderID != shader.ID)
+        {
+            cachedUniforms.shaderID = shader.ID;
+            cachedUniforms.layers = shader.uniform<glm::ivec4>("materialLayers");
+            cachedUniforms.useMaterialTable = shader.uniform<bool>("useMaterialTable");
+        }
+        return cachedUniforms;
+    }
+
+    static const string *slotTypes()
+    {
+        static const string types[slotCount] = {"texture_diffuse", "texture_specular", "texture_normal", "texture_ambient"};
+        return types;
+    }
+
+    // the compressed format of the textures if they all have the same one and all their mip levels
+    // (see TextureCompressor), 0 otherwise
+    static GLenum compressedFormat(const vector<unsigned int> &textures, GLint width, GLint height)
+    {
+        GLint levels = 1;
+        while (width > 1 || height > 1)
+        {
+            width = max(1, width / 2);
+            height = max(1, height / 2);
+            levels++;
+        }
+        GLint format = 0;
+        for (unsigned int i = 0; i < textures.size(); i++)
+        {
+            GLint compressed, textureFormat, maxLevel;
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &textureFormat);
+            glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+            if (!compressed || maxLevel != levels - 1 || (i > 0 && textureFormat != format))
+                return 0;
+            format = textureFormat;
+        }
+        return format;
+    }
+
+    // copies the blocks of every level of the textures to the bound array, as they are, through the pixel buffer
+    // 'staging' (bound to GL_PIXEL_PACK_BUFFER)
+    static void copyCompressed(const vector<unsigned int> &textures, GLenum format, GLint width, GLint height, unsigned int staging)
+    {
+        for (GLint level = 0; ; level++)
+        {
+            GLint size;
+            glBindTexture(GL_TEXTURE_2D, textures[0]);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, format, width, height, textures.size(), 0, size * textures.size(), NULL);
+            glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_COPY);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging);
+            for (unsigned int layer = 0; layer < textures.size(); layer++)
+            {
+                glBindTexture(GL_TEXTURE_2D, textures[layer]);
+                glGetCompressedTexImage(GL_TEXTURE_2D, level, (void*)0);
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, format, size, (void*)0);
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            if (width == 1 && height == 1)
+            {
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, level);
+                break;
+            }
+            width = max(1, width / 2);
+            height = max(1, height / 2);
+        }
+    }
+
+    static const Texture *firstOfType(const vector<Texture> &textures, const string &type)
+    {
+        for (unsigned int i = 0; i < textures.size(); i++)
+            if (textures[i].type == type)
+                return &textures[i];
+        return nullptr;
+    }
+};
+
+// Material tables shared by all the models of the program, so that models with the same materials (e.g. the same
+// model loaded twice) don't each keep a copy of the textures. Tables are identified by a key the model makes from the
+// files of its textures. Every acquire that returns a table must be matched by a release, the table is deleted when the
+// last user releases it (this must happen while the GL context still exists)
+class MaterialTableCache
+{
+public:
+    static MaterialTableCache& instance()
+    {
+        static MaterialTableCache cache;
+        return cache;
+    }
+
+    // returns the table of 'key', building it from 'materials' if no one is using it yet, or nullptr if the
+    // textures can't be packed (see MaterialTable::build)
+    MaterialTable *acquire(const string &key, const vector<vector<Texture>> &materials)
+    {
+        auto it = tables.find(key);
+        if (it == tables.end())
+        {
+            unique_ptr<MaterialTable> table(new MaterialTable());
+            if (!table->build(materials))
+                return nullptr;
+            it = tables.insert(make_pair(key, Entry())).first;
+            it->second.table = std::move(table);
+        }
+        it->second.users++;
+        return it->second.table.get();
+    }
+
+    void release(MaterialTable *table)
+    {
+        for (auto it = tables.begin(); it != tables.end(); ++it)
+        {
+            if (it->second.table.get() != table)
+                continue;
+            if (--it->second.users == 0)
+                tables.erase(it);
+            return;
+        }
+    }
+
+    // number of different tables currently built
+    size_t size() const { return tables.size(); }
+
+private:
+    struct Entry
+    {
+        unique_ptr<MaterialTable> table;
+        unsigned int users = 0;
+    };
+
+    unordered_map<string, Entry> tables;
+
+    MaterialTableCache() = default;
+    MaterialTableCache(const MaterialTableCache&) = delete;
+    MaterialTableCache& operator=(const MaterialTableCache&) = delete;
+};
+
+#endif
@@ -13,6 +13,8 @@
 #include <sstream>
 #include <iostream>
 #include <vector>
+#include <utility>
+#include <cfloat>
 using namespace std;
 
 struct Vertex {
@@ -28,10 +30,32 @@ struct Vertex {
     glm::vec3 Bitangent;
 };
 
+// a Vertex in 20 bytes instead of 56, for meshes that are only drawn (see Model, the shaders unpack it).
+// The normal and the tangent are octahedral encoded in two components, the bitangent is rebuilt in the shader as
+// cross(normal, tangent) times the sign stored with the position
+struct PackedVertex {
+    // position relative to the bounds of the model, 16 bit snorm x, y, z, and the sign of the bitangent as w
+    unsigned int Position[2];
+    // normal, octahedral 16 bit snorm
+    unsigned int Normal;
+    // tangent, octahedral 16 bit snorm
+    unsigned int Tangent;
+    // texCoords, half floats
+    unsigned int TexCoords;
+};
+
 struct Texture {
     unsigned int id;
     string type;
     string path;
+    string sampler; // name of the sampler uniform the texture is bound to, set by the Mesh (see AssignSamplers)
+};
+
+// handles of the samplers of a list of textures in a shader, looked up the first time the textures are bound with that
+// shader and reused by the next draws (see Mesh::BindTextures)
+struct TextureSamplers {
+    unsigned int shaderID = 0;
+    vector<Shader::Uniform<int>> handles;
 };
 
 class Mesh {
@@ -40,34 +64,77 @@ public:
     vector<Vertex> vertices;
     vector<unsigned int> indices;
     vector<Texture> textures;
-    unsigned int VAO;
+    TextureSamplers samplers;
+    unsigned int VAO = 0;
+    // these stay valid after ReleaseCPUData
+    unsigned int vertexCount = 0, indexCount = 0;
+    glm::vec3 boundsMin = glm::vec3(0.0f), boundsMax = glm::vec3(0.0f);
+    // simplified versions of the mesh (LOD1, LOD2...), triangles of the same vertices, and the distance their surface
+    // can be from the full mesh (see MeshSimplifier). Only drawn by batched models
+    vector<vector<unsigned int>> lodIndices;
+    vector<float> lodErrors;
 
     /*  Functions  */
     // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    // the arrays are moved into the mesh, pass them with std::move to avoid copying them
+    // meshes that are drawn as part of a batch (see Model) don't need buffers of their own, upload is false for them
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, bool upload = true)
+        : vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures))
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        AssignSamplers(this->textures);
+        vertexCount = this->vertices.size();
+        indexCount = this->indices.size();
+        if (!this->vertices.empty())
+        {
+            boundsMin = glm::vec3(FLT_MAX);
+            boundsMax = glm::vec3(-FLT_MAX);
+            for (const Vertex &vertex : this->vertices)
+            {
+                boundsMin = glm::min(boundsMin, vertex.Position);
+                boundsMax = glm::max(boundsMax, vertex.Position);
+            }
+        }
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        if (upload)
+            setupMesh();
     }
 
     // render the mesh
-    void Draw(Shader shader)
+    void Draw(Shader &shader)
+    {
+        BindTextures(shader, textures, samplers);
+
+        // draw mesh
+        glBindVertexArray(VAO);
+        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+        glBindVertexArray(0);
+
+        // always good practice to set everything back to defaults once configured.
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // frees the vertices and indices once they are in GPU memory, only the counts and bounds are kept
+    void ReleaseCPUData()
+    {
+        vector<Vertex>().swap(vertices);
+        vector<unsigned int>().swap(indices);
+        vector<vector<unsigned int>>().swap(lodIndices);
+    }
+
+    // names the sampler of each texture after its type and its number among the textures of that type
+    // (texture_diffuse1, texture_diffuse2, texture_normal1...), once, so that drawing doesn't build strings
+    static void AssignSamplers(vector<Texture> &textures)
     {
-        // bind appropriate textures
         unsigned int diffuseNr  = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr   = 1;
         unsigned int ambientNr   = 1;
         for(unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             string number;
-            string name = textures[i].type;
+            const string &name = textures[i].type;
             if(name == "texture_diffuse")
                 number = std::to_string(diffuseNr++);
             else if(name == "texture_specular")
@@ -76,20 +143,83 @@ public:
                 number = std::to_string(normalNr++); // transfer unsigned int to stream
             else if(name == "texture_ambient")
                 number = std::to_string(ambientNr++); // transfer unsigned int to stream
+            textures[i].sampler = name + number;
+        }
+    }
 
+    // binds the textures to consecutive texture units and sets the samplers of the shader, samplers keeps their handles
+    // so that they are only looked up when the shader changes
+    static void BindTextures(Shader &shader, const vector<Texture> &textures, TextureSamplers &samplers)
+    {
+        if (samplers.shaderID != shader.ID || samplers.handles.size() != textures.size())
+        {
+            samplers.shaderID = shader.ID;
+            samplers.handles.resize(textures.size());
+            for(unsigned int i = 0; i < textures.size(); i++)
+                samplers.handles[i] = shader.uniform<int>(textures[i].sampler);
+        }
+        // bind appropriate textures
+        for(unsigned int i = 0; i < textures.size(); i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
+            shader.setInt(samplers.handles[i], i);
             // and finally bind the texture
             glBindTexture(GL_TEXTURE_2D, textures[i].id);
         }
+    }
 
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+    // sets the vertex attribute pointers of the bound vertex array, for a vertex buffer of Vertex structs
+    static void SetupVertexAttributes()
+    {
+        // vertex Positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+        // vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+        // vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        // vertex tangent
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+        // vertex bitangent
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+    }
 
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    // packs a vertex whose position is inside the box of the given center and half size (see PackedVertex)
+    static PackedVertex PackVertex(const Vertex &vertex, const glm::vec3 &center, const glm::vec3 &halfSize)
+    {
+        PackedVertex packed;
+        glm::vec3 position = (vertex.Position - center) / halfSize;
+        float bitangentSign = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? -1.0f : 1.0f;
+        packed.Position[0] = glm::packSnorm2x16(glm::vec2(position.x, position.y));
+        packed.Position[1] = glm::packSnorm2x16(glm::vec2(position.z, bitangentSign));
+        packed.Normal = glm::packSnorm2x16(octahedralEncode(vertex.Normal));
+        packed.Tangent = glm::packSnorm2x16(octahedralEncode(vertex.Tangent));
+        packed.TexCoords = glm::packHalf2x16(vertex.TexCoords);
+        return packed;
+    }
+
+    // sets the vertex attribute pointers of the bound vertex array, for a vertex buffer of PackedVertex structs.
+    // The attributes have the locations of the Vertex ones, the bitangent (4) is not an array
+    static void SetupPackedVertexAttributes()
+    {
+        // vertex Positions and bitangent sign
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 4, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)0);
+        // vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Normal));
+        // vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, TexCoords));
+        // vertex tangent
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Tangent));
+        glDisableVertexAttribArray(4);
     }
 
 private:
@@ -117,23 +247,23 @@ private:
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
 
         // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        SetupVertexAttributes();
 
         glBindVertexArray(0);
     }
+
+    // maps a unit vector to the octahedron |x| + |y| + |z| = 1, unfolded on the square [-1, 1]^2
+    // (the lower half is folded over the diagonals). unpackDirection in the shaders does the opposite
+    static glm::vec2 octahedralEncode(const glm::vec3 &v)
+    {
+        float length = glm::abs(v.x) + glm::abs(v.y) + glm::abs(v.z);
+        if (length == 0.0f)
+            return glm::vec2(0.0f);
+        glm::vec3 n = v / length;
+        if (n.z >= 0.0f)
+            return glm::vec2(n.x, n.y);
+        return glm::vec2((1.0f - glm::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+                         (1.0f - glm::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+    }
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,314 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <mesh.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+using namespace std;
+
+// Simplifies triangle meshes by collapsing edges, cheapest first, with the quadric error metric (Garland and
+// Heckbert 1997, "Surface Simplification Using Quadric Error Metrics"): every vertex accumulates the planes of the
+// triangles around it, and moving it costs its mean squared distance to those planes.
+//
+// An edge collapse moves one vertex onto the other, so the simplified mesh is a new index buffer for the same vertices.
+// Vertices that share their position with other vertices (UV seams, hard edges where the normals are split) and the
+// vertices of open borders never move, which keeps the seams, the normals and the outline of the mesh.
+class MeshSimplifier
+{
+public:
+    // returns the indices of the simplified triangles, at most targetIndexCount if that can be done by moving vertices
+    // less than maxError (in the units of the positions). 'error' is set to the largest distance a vertex moved
+    static vector<unsigned int> simplify(const vector<Vertex> &vertices, const vector<unsigned int> &indices,
+                                         size_t targetIndexCount, float maxError, float *error = nullptr)
+    {
+        vector<unsigned int> result(indices);
+        if (error)
+            *error = 0.0f;
+        if (indices.size() % 3 != 0)
+            return result;
+
+        // vertices with the same position share their quadric, and can only move if they are the only one there
+        vector<unsigned int> positionOf(vertices.size());
+        vector<unsigned int> wedges;
+        {
+            unordered_map<glm::vec3, unsigned int, PositionHash, PositionEqual> positions;
+            for (unsigned int v = 0; v < vertices.size(); v++)
+            {
+                auto it = positions.insert(make_pair(vertices[v].Position, (unsigned int) wedges.size()));
+                if (it.second)
+                    wedges.push_back(0);
+                positionOf[v] = it.first->second;
+                wedges[positionOf[v]]++;
+            }
+        }
+        vector<bool> locked(vertices.size());
+        for (unsigned int v = 0; v < vertices.size(); v++)
+            locked[v] = wedges[positionOf[v]] > 1;
+        lockBorders(positionOf, result, locked);
+
+        vector<Quadric> quadrics(wedges.size());
+        for (unsigned int i = 0; i < result.size(); i += 3)
+        {
+            const glm::vec3 &p0 = vertices[result[i]].Position;
+            glm::vec3 normal = glm::cross(vertices[result[i + 1]].Position - p0, vertices[result[i + 2]].Position - p0);
+            float area = glm::length(normal) * 0.5f;
+            if (area == 0.0f)
+                continue;
+            Quadric plane(normal / (2.0f * area), p0, area);
+            for (unsigned int k = 0; k < 3; k++)
+                quadrics[positionOf[result[i + k]]] += plane;
+        }
+
+        vector<Collapse> collapses;
+        vector<unsigned int> remap(vertices.size());
+        vector<bool> touched(vertices.size());
+        vector<unsigned int> firstTriangle, adjacency;
+        double maxCost = double(maxError) * maxError;
+
+        while (result.size() > targetIndexCount)
+        {
+            buildAdjacency(result, vertices.size(), firstTriangle, adjacency);
+
+            // every edge, in both directions
+            collapses.clear();
+            for (unsigned int i = 0; i < result.size(); i += 3)
+            {
+                for (unsigned int k = 0; k < 3; k++)
+                {
+                    unsigned int a = result[i + k], b = result[i + (k + 1) % 3];
+                    if (!locked[a])
+                        collapses.push_back(Collapse(a, b, collapseCost(vertices, positionOf, quadrics, a, b)));
+                    if (!locked[b])
+                        collapses.push_back(Collapse(b, a, collapseCost(vertices, positionOf, quadrics, b, a)));
+                }
+            }
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+            // the cheapest collapses that don't involve the same triangles. Each collapse removes the (usually 2)
+            // triangles of the edge
+            for (unsigned int v = 0; v < vertices.size(); v++)
+                remap[v] = v;
+            std::fill(touched.begin(), touched.end(), false);
+            size_t triangleCount = result.size() / 3, targetTriangleCount = targetIndexCount / 3;
+            unsigned int collapsed = 0;
+            for (unsigned int c = 0; c < collapses.size() && triangleCount > targetTriangleCount; c++)
+            {
+                const Collapse &collapse = collapses[c];
+                if (collapse.cost > maxCost)
+                    break;
+                if (touched[collapse.from] || touched[collapse.to])
+                    continue;
+                unsigned int removed = 0;
+                if (!canCollapse(vertices, positionOf, result, firstTriangle, adjacency, collapse.from, collapse.to, removed))
+                    continue;
+
+                remap[collapse.from] = collapse.to;
+                for (unsigned int a = firstTriangle[collapse.from]; a < firstTriangle[collapse.from + 1]; a++)
+                    for (unsigned int k = 0; k < 3; k++)
+                        touched[result[adjacency[a] * 3 + k]] = true;
+                quadrics[positionOf[collapse.to]] += quadrics[positionOf[collapse.from]];
+                if (error)
+                    *error = max(*error, (float) sqrt(collapse.cost));
+                triangleCount -= removed;
+                collapsed++;
+            }
+            if (collapsed == 0)
+                break;
+
+            // move the collapsed vertices and remove the triangles that became degenerate
+            size_t kept = 0;
+            for (unsigned int i = 0; i < result.size(); i += 3)
+            {
+                unsigned int a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+                if (a == b || b == c || c == a)
+                    continue;
+                result[kept++] = a;
+                result[kept++] = b;
+                result[kept++] = c;
+            }
+            result.resize(kept);
+        }
+        return result;
+    }
+
+private:
+    // symmetric 4x4 matrix of the sum of the squared distances to planes, weighted by area
+    struct Quadric
+    {
+        double a00 = 0, a01 = 0, a02 = 0, a03 = 0, a11 = 0, a12 = 0, a13 = 0, a22 = 0, a23 = 0, a33 = 0;
+        double weight = 0;
+
+        Quadric() = default;
+        Quadric(const glm::vec3 &n, const glm::vec3 &p, float w)
+        {
+            double a = n.x, b = n.y, c = n.z, d = -glm::dot(n, p);
+            a00 = w * a * a; a01 = w * a * b; a02 = w * a * c; a03 = w * a * d;
+            a11 = w * b * b; a12 = w * b * c; a13 = w * b * d;
+            a22 = w * c * c; a23 = w * c * d;
+            a33 = w * d * d;
+            weight = w;
+        }
+
+        Quadric& operator+=(const Quadric &q)
+        {
+            a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03; a11 += q.a11; a12 += q.a12; a13 += q.a13;
+            a22 += q.a22; a23 += q.a23; a33 += q.a33; weight += q.weight;
+            return *this;
+        }
+
+        // weighted sum of the squared distances of p to the planes
+        double evaluate(const glm::vec3 &p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            return a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+                 + a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+                 + a22 * z * z + 2 * a23 * z
+                 + a33;
+        }
+    };
+
+    struct Collapse
+    {
+        unsigned int from, to;
+        double cost;
+        Collapse(unsigned int from, unsigned int to, double cost) : from(from), to(to), cost(cost) {}
+    };
+
+    struct PositionHash
+    {
+        size_t operator()(const glm::vec3 &p) const
+        {
+            uint32_t bits[3];
+            memcpy(bits, &p[0], sizeof(bits));
+            return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+        }
+    };
+    struct PositionEqual
+    {
+        bool operator()(const glm::vec3 &a, const glm::vec3 &b) const { return a == b; }
+    };
+
+    // mean squared distance of the vertex 'to' to the planes of both vertices
+    static double collapseCost(const vector<Vertex> &vertices, const vector<unsigned int> &positionOf,
+                               const vector<Quadric> &quadrics, unsigned int from, unsigned int to)
+    {
+        Quadric q = quadrics[positionOf[from]];
+        q += quadrics[positionOf[to]];
+        if (q.weight == 0.0)
+            return 0.0;
+        return max(0.0, q.evaluate(vertices[to].Position) / q.weight);
+    }
+
+    // locks the vertices of the edges that have a single triangle (or more than two), comparing positions,
+    // since the triangles on both sides of a seam don't share their vertices
+    static void lockBorders(const vector<unsigned int> &positionOf, const vector<unsigned int> &indices, vector<bool> &locked)
+    {
+        unordered_map<uint64_t, unsigned int> edgeTriangles;
+        edgeTriangles.reserve(indices.size());
+        for (unsigned int i = 0; i < indices.size(); i += 3)
+            for (unsigned int k = 0; k < 3; k++)
+                edgeTriangles[edgeKey(positionOf[indices[i + k]], positionOf[indices[i + (k + 1) % 3]])]++;
+
+        vector<bool> lockedPosition(positionOf.size(), false);
+        for (unsigned int i = 0; i < indices.size(); i += 3)
+        {
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                unsigned int a = positionOf[indices[i + k]], b = positionOf[indices[i + (k + 1) % 3]];
+                if (edgeTriangles[edgeKey(a, b)] != 2)
+                    lockedPosition[a] = lockedPosition[b] = true;
+            }
+        }
+        for (unsigned int v = 0; v < positionOf.size(); v++)
+            if (lockedPosition[positionOf[v]])
+                locked[v] = true;
+    }
+
+    static uint64_t edgeKey(unsigned int a, unsigned int b)
+    {
+        return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+    }
+
+    // triangles of each vertex
+    static void buildAdjacency(const vector<unsigned int> &indices, size_t vertexCount,
+                               vector<unsigned int> &firstTriangle, vector<unsigned int> &adjacency)
+    {
+        firstTriangle.assign(vertexCount + 1, 0);
+        adjacency.resize(indices.size());
+        for (unsigned int i = 0; i < indices.size(); i++)
+            firstTriangle[indices[i] + 1]++;
+        for (unsigned int v = 0; v < vertexCount; v++)
+            firstTriangle[v + 1] += firstTriangle[v];
+        vector<unsigned int> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+        for (unsigned int i = 0; i < indices.size(); i++)
+            adjacency[filled[indices[i]]++] = i / 3;
+    }
+
+    // the collapse of 'from' onto 'to' is rejected if a triangle that stays would flip or become much steeper, if
+    // a triangle of the edge uses another vertex at the position of 'to' (the collapse would cross a seam), or if
+    // the vertices have more common neighbours than the edge has triangles (the surface would fold onto itself).
+    // 'removed' is set to the number of triangles of the edge
+    static bool canCollapse(const vector<Vertex> &vertices, const vector<unsigned int> &positionOf,
+                            const vector<unsigned int> &indices, const vector<unsigned int> &firstTriangle,
+                            const vector<unsigned int> &adjacency, unsigned int from, unsigned int to, unsigned int &removed)
+    {
+        removed = 0;
+        vector<unsigned int> neighbours;
+        for (unsigned int a = firstTriangle[from]; a < firstTriangle[from + 1]; a++)
+        {
+            const unsigned int *triangle = &indices[adjacency[a] * 3];
+            bool hasTo = false;
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                if (triangle[k] == to)
+                    hasTo = true;
+                else if (positionOf[triangle[k]] == positionOf[to])
+                    return false;
+            }
+            for (unsigned int k = 0; k < 3; k++)
+                if (triangle[k] != from && triangle[k] != to)
+                    neighbours.push_back(triangle[k]);
+            if (hasTo)
+            {
+                removed++;
+                continue;
+            }
+
+            glm::vec3 p[3], q[3];
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                p[k] = vertices[triangle[k]].Position;
+                q[k] = triangle[k] == from ? vertices[to].Position : p[k];
+            }
+            glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+            glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+            float lengths = glm::length(before) * glm::length(after);
+            if (lengths == 0.0f || glm::dot(before, after) < 0.25f * lengths)
+                return false;
+        }
+        if (removed == 0)
+            return false;
+
+        std::sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+        vector<unsigned int> common;
+        for (unsigned int a = firstTriangle[to]; a < firstTriangle[to + 1]; a++)
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                unsigned int v = indices[adjacency[a] * 3 + k];
+                if (std::binary_search(neighbours.begin(), neighbours.end(), v))
+                    common.push_back(v);
+            }
+        std::sort(common.begin(), common.end());
+        return std::unique(common.begin(), common.end()) - common.begin() <= removed;
+    }
+};
+
+#endif
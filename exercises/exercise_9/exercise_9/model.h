@@ -13,6 +13,11 @@
 
 #include <mesh.h>
 #include <shader.h>
+#include <texture_cache.h>
+#include <material_table.h>
+#include <mesh_optimizer.h>
+#include <mesh_simplifier.h>
+#include <camera.h>
 
 #include <string>
 #include <fstream>
@@ -20,34 +25,202 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <algorithm>
+#include <cmath>
 using namespace std;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false,
+                             TextureCompressor::Kind kind = TextureCompressor::Color, bool compress = false);
 
 class Model
 {
 public:
     /*  Model Data */
-    vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+    vector<Texture> textures_loaded;	// textures used by this model, each one holds a reference in the TextureCache that is released by the destructor
     vector<Mesh> meshes;
     string directory;
     bool gammaCorrection;
+    // if true, all the meshes share one vertex and one index buffer and are drawn with a few multi-draw calls (see buildBatches)
+    bool batched;
+    // if false, the vertices and indices of the meshes are freed once they have been uploaded (see Mesh::ReleaseCPUData)
+    bool keepCPUData;
+    // if true (and batched), the vertex buffer holds PackedVertex structs instead of Vertex ones, the shaders unpack them
+    bool packedVertices;
+    // number of simplified versions of each mesh generated at load time (batched models only), each one has half the
+    // triangles of the previous one
+    static const unsigned int maxLODs = 4;
+    // the most the surface of a LOD can be from the full mesh on screen, in pixels (see SelectLOD)
+    float lodThreshold = 1.0f;
+    // if true (and batched), the textures are packed in texture arrays once they are loaded and the whole model is
+    // drawn with one call (see MaterialTable). The arrays are copies shared by the models with the same textures, the
+    // model keeps its own textures, its batches and meshes still refer to them
+    bool useMaterialTable = false;
 
     /*  Functions   */
     // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    // by default every mesh is drawn on its own and keeps its vertices, batched models opt in to the faster paths
+    Model(string const &path, bool gamma = false, bool batched = false, bool keepCPUData = true, bool packedVertices = false)
+        : gammaCorrection(gamma), batched(batched), keepCPUData(keepCPUData), packedVertices(batched && packedVertices)
     {
         loadModel(path);
+        if (batched)
+            buildBatches();
+        if (!keepCPUData)
+            for (unsigned int i = 0; i < meshes.size(); i++)
+                meshes[i].ReleaseCPUData();
+    }
+
+    ~Model()
+    {
+        for(unsigned int i = 0; i < textures_loaded.size(); i++)
+            TextureCache::instance().release(textures_loaded[i].id);
+        if (batched)
+        {
+            glDeleteVertexArrays(1, &VAO);
+            glDeleteBuffers(1, &VBO);
+            glDeleteBuffers(1, &EBO);
+            if (materialVBO)
+                glDeleteBuffers(1, &materialVBO);
+        }
+        if (materialTable)
+            MaterialTableCache::instance().release(materialTable);
+    }
+
+    // a copy would release the textures twice
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+
+    // picks the LOD Draw uses for every mesh: the simplest one whose error, projected at the distance of the mesh
+    // from the camera, is at most lodThreshold pixels. Call it before every Draw with the model matrix of that draw
+    void SelectLOD(const glm::mat4 &modelMatrix, const Camera &camera, float screenHeight)
+    {
+        if (!batched)
+            return;
+        float scale = max(glm::length(glm::vec3(modelMatrix[0])), max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+        // size in pixels of one unit at distance 1
+        float pixelsPerUnit = screenHeight / (2.0f * tan(glm::radians(camera.Zoom) * 0.5f));
+        for (unsigned int i = 0; i < lodChains.size(); i++)
+        {
+            const LODChain &chain = lodChains[i];
+            glm::vec3 center = glm::vec3(modelMatrix * glm::vec4(chain.center, 1.0f));
+            float distance = max(glm::length(center - camera.Position) - chain.radius * scale, 1e-3f);
+            unsigned int lod = 0;
+            while (lod + 1 < chain.counts.size() && chain.errors[lod + 1] * scale * pixelsPerUnit / distance <= lodThreshold)
+                lod++;
+            batches[chain.batch].counts[chain.slot] = chain.counts[lod];
+            batches[chain.batch].firstIndices[chain.slot] = chain.firstIndices[lod];
+            allMeshes.counts[chain.allMeshesSlot] = chain.counts[lod];
+            allMeshes.firstIndices[chain.allMeshesSlot] = chain.firstIndices[lod];
+        }
     }
 
     // draws the model, and thus all its meshes
-    void Draw(Shader shader)
+    void Draw(Shader &shader)
     {
-        for(unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+        const Uniforms &u = uniforms(shader);
+        if (!batched)
+        {
+            shader.setBool(u.packedVertices, false);
+            shader.setBool(u.useMaterialTable, false);
+            for(unsigned int i = 0; i < meshes.size(); i++)
+                meshes[i].Draw(shader);
+            return;
+        }
+
+        shader.setBool(u.packedVertices, packedVertices);
+        if (packedVertices)
+        {
+            shader.setVec3(u.positionCenter, positionCenter);
+            shader.setVec3(u.positionHalfSize, positionHalfSize);
+        }
+
+        glBindVertexArray(VAO);
+        if (useMaterialTable && !materialTableTried)
+            buildMaterialTable();
+        if (materialTable)
+        {
+            // the textures of all the materials are in the same arrays, the whole model is a single draw call
+            materialTable->bind(shader);
+            glMultiDrawElementsBaseVertex(GL_TRIANGLES, allMeshes.counts.data(), GL_UNSIGNED_INT, allMeshes.firstIndices.data(),
+                                          allMeshes.counts.size(), allMeshes.baseVertices.data());
+            glBindVertexArray(0);
+            glActiveTexture(GL_TEXTURE0);
+            return;
+        }
+
+        // one draw call per material, the textures are bound once for all the meshes that use them
+        shader.setBool(u.useMaterialTable, false);
+        for(unsigned int i = 0; i < batches.size(); i++)
+        {
+            Batch &batch = batches[i];
+            Mesh::BindTextures(shader, batch.textures, batch.samplers);
+            glMultiDrawElementsBaseVertex(GL_TRIANGLES, batch.counts.data(), GL_UNSIGNED_INT, batch.firstIndices.data(),
+                                          batch.counts.size(), batch.baseVertices.data());
+        }
+        glBindVertexArray(0);
+
+        // always good practice to set everything back to defaults once configured.
+        glActiveTexture(GL_TEXTURE0);
     }
 
 private:
+    /*  Batched render data  */
+    // the meshes that use the same textures, drawn by a single glMultiDrawElementsBaseVertex
+    struct Batch
+    {
+        vector<Texture> textures;
+        TextureSamplers samplers;
+        vector<GLsizei> counts;             // number of indices of each mesh
+        vector<const void*> firstIndices;   // byte offset of the first index of each mesh in the index buffer
+        vector<GLint> baseVertices;         // position of the first vertex of each mesh in the vertex buffer
+        vector<unsigned int> vertexCounts;  // number of vertices of each mesh
+    };
+    vector<Batch> batches;
+    // the meshes of all the batches, drawn with a single call when the material table is ready
+    Batch allMeshes;
+    unsigned int VAO = 0, VBO = 0, EBO = 0;
+    size_t totalVertexCount = 0;
+    // the LODs of a mesh in the index buffer, and where the mesh is drawn
+    struct LODChain
+    {
+        unsigned int batch, slot, allMeshesSlot;    // position of the mesh in batches and in allMeshes
+        glm::vec3 center;
+        float radius;
+        vector<GLsizei> counts;                     // number of indices of LOD0, LOD1...
+        vector<const void*> firstIndices;
+        vector<float> errors;
+    };
+    vector<LODChain> lodChains;
+    // box the packed positions are relative to, the bounds of the model
+    glm::vec3 positionCenter = glm::vec3(0.0f), positionHalfSize = glm::vec3(1.0f);
+
+    // locations of the uniforms set by Draw, looked up again only when it is called with another shader
+    struct Uniforms
+    {
+        unsigned int shaderID = 0;
+        Shader::Uniform<bool> packedVertices, useMaterialTable;
+        Shader::Uniform<glm::vec3> positionCenter, positionHalfSize;
+    } cachedUniforms;
+
+    const Uniforms &uniforms(const Shader &shader)
+    {
+        if (cachedUniforms.shaderID != shader.ID)
+        {
+            cachedUniforms.shaderID = shader.ID;
+            cachedUniforms.packedVertices = shader.uniform<bool>("packedVertices");
+            cachedUniforms.positionCenter = shader.uniform<glm::vec3>("positionCenter");
+            cachedUniforms.positionHalfSize = shader.uniform<glm::vec3>("positionHalfSize");
+            cachedUniforms.useMaterialTable = shader.uniform<bool>("useMaterialTable");
+        }
+        return cachedUniforms;
+    }
+
+    // the textures of the batches in texture arrays, the index of the batch is the material of its vertices
+    // (shared with the models that have the same textures, see MaterialTableCache)
+    MaterialTable *materialTable = nullptr;
+    bool materialTableTried = false;
+    unsigned int materialVBO = 0;
+
     /*  Functions   */
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
     void loadModel(string const &path)
@@ -65,6 +238,7 @@ private:
         directory = path.substr(0, path.find_last_of('/'));
 
         // process ASSIMP's root node recursively
+        meshes.reserve(scene->mNumMeshes);
         processNode(scene->mRootNode, scene);
     }
 
@@ -93,6 +267,8 @@ private:
         vector<Vertex> vertices;
         vector<unsigned int> indices;
         vector<Texture> textures;
+        vertices.reserve(mesh->mNumVertices);
+        indices.reserve(mesh->mNumFaces * 3);
 
         // Walk through each of the mesh's vertices
         for(unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -163,11 +339,198 @@ private:
         std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_ambient");
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
 
+        // weld the vertices and reorder the triangles and vertices for the GPU caches, assimp gives them in file order
+        MeshOptimizer::optimize(vertices, indices, directory + '/' + mesh->mName.C_Str());
+
         // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        // in batched mode, the mesh is uploaded by buildBatches together with the other meshes, and its LODs with it
+        Mesh result(std::move(vertices), std::move(indices), std::move(textures), !batched);
+        if (batched)
+            generateLODs(result);
+        return result;
+    }
+
+    static bool sameTextures(const vector<Texture> &a, const vector<Texture> &b)
+    {
+        if (a.size() != b.size())
+            return false;
+        for (unsigned int i = 0; i < a.size(); i++)
+            if (a[i].id != b[i].id || a[i].type != b[i].type)
+                return false;
+        return true;
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
+    // packs the vertices and indices of all the meshes in one vertex and one index buffer, and groups the meshes by
+    // material. The indices of each mesh are kept relative to its first vertex, the base vertex of the draw adds the offset
+    void buildBatches()
+    {
+        size_t vertexCount = 0, indexCount = 0;
+        glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            vertexCount += meshes[i].vertexCount;
+            indexCount += meshes[i].indexCount;
+            for (unsigned int l = 0; l < meshes[i].lodIndices.size(); l++)
+                indexCount += meshes[i].lodIndices[l].size();
+            if (meshes[i].vertexCount > 0)
+            {
+                boundsMin = glm::min(boundsMin, meshes[i].boundsMin);
+                boundsMax = glm::max(boundsMax, meshes[i].boundsMax);
+            }
+        }
+        if (vertexCount > 0)
+        {
+            positionCenter = (boundsMin + boundsMax) * 0.5f;
+            // a flat model would divide by 0
+            positionHalfSize = glm::max((boundsMax - boundsMin) * 0.5f, glm::vec3(1e-6f));
+        }
+        size_t vertexSize = packedVertices ? sizeof(PackedVertex) : sizeof(Vertex);
+        vector<PackedVertex> packed;
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * vertexSize, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+
+        size_t firstVertex = 0, firstIndex = 0;
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            const Mesh &mesh = meshes[i];
+            if (mesh.indexCount == 0)
+                continue;
+            if (packedVertices)
+            {
+                packed.resize(mesh.vertices.size());
+                for (unsigned int v = 0; v < mesh.vertices.size(); v++)
+                    packed[v] = Mesh::PackVertex(mesh.vertices[v], positionCenter, positionHalfSize);
+                glBufferSubData(GL_ARRAY_BUFFER, firstVertex * vertexSize, packed.size() * vertexSize, packed.data());
+            }
+            else
+                glBufferSubData(GL_ARRAY_BUFFER, firstVertex * vertexSize, mesh.vertices.size() * vertexSize, mesh.vertices.data());
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, firstIndex * sizeof(unsigned int), mesh.indices.size() * sizeof(unsigned int), mesh.indices.data());
+
+            unsigned int b = 0;
+            while (b < batches.size() && !sameTextures(batches[b].textures, mesh.textures))
+                b++;
+            if (b == batches.size())
+            {
+                batches.push_back(Batch());
+                batches.back().textures = mesh.textures;
+            }
+            batches[b].counts.push_back(mesh.indexCount);
+            batches[b].firstIndices.push_back((const void*)(firstIndex * sizeof(unsigned int)));
+            batches[b].baseVertices.push_back(firstVertex);
+            batches[b].vertexCounts.push_back(mesh.vertexCount);
+
+            // the LODs follow the full mesh in the index buffer
+            LODChain chain;
+            chain.batch = b;
+            chain.slot = batches[b].counts.size() - 1;
+            chain.center = (mesh.boundsMin + mesh.boundsMax) * 0.5f;
+            chain.radius = glm::length(mesh.boundsMax - mesh.boundsMin) * 0.5f;
+            chain.counts.push_back(mesh.indexCount);
+            chain.firstIndices.push_back(batches[b].firstIndices.back());
+            chain.errors.push_back(0.0f);
+            firstVertex += mesh.vertexCount;
+            firstIndex += mesh.indexCount;
+            for (unsigned int l = 0; l < mesh.lodIndices.size(); l++)
+            {
+                const vector<unsigned int> &lod = mesh.lodIndices[l];
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, firstIndex * sizeof(unsigned int), lod.size() * sizeof(unsigned int), lod.data());
+                chain.counts.push_back(lod.size());
+                chain.firstIndices.push_back((const void*)(firstIndex * sizeof(unsigned int)));
+                chain.errors.push_back(mesh.lodErrors[l]);
+                firstIndex += lod.size();
+            }
+            lodChains.push_back(chain);
+        }
+
+        if (packedVertices)
+            Mesh::SetupPackedVertexAttributes();
+        else
+            Mesh::SetupVertexAttributes();
+        glBindVertexArray(0);
+        totalVertexCount = vertexCount;
+
+        vector<unsigned int> firstOfBatch(batches.size(), 0);
+        for (unsigned int b = 0; b < batches.size(); b++)
+        {
+            const Batch &batch = batches[b];
+            firstOfBatch[b] = allMeshes.counts.size();
+            allMeshes.counts.insert(allMeshes.counts.end(), batch.counts.begin(), batch.counts.end());
+            allMeshes.firstIndices.insert(allMeshes.firstIndices.end(), batch.firstIndices.begin(), batch.firstIndices.end());
+            allMeshes.baseVertices.insert(allMeshes.baseVertices.end(), batch.baseVertices.begin(), batch.baseVertices.end());
+        }
+        for (unsigned int i = 0; i < lodChains.size(); i++)
+            lodChains[i].allMeshesSlot = firstOfBatch[lodChains[i].batch] + lodChains[i].slot;
+    }
+
+    // simplifies the mesh into LOD1, LOD2... each with half the triangles of the previous one, until the simplifier
+    // can't remove a quarter of them anymore without moving the surface more than 5% of the size of the mesh.
+    // The errors add up, since every LOD is simplified from the previous one
+    static void generateLODs(Mesh &mesh)
+    {
+        float maxError = 0.05f * glm::length(mesh.boundsMax - mesh.boundsMin);
+        float error = 0.0f;
+        for (unsigned int l = 0; l < maxLODs; l++)
+        {
+            const vector<unsigned int> &previous = l == 0 ? mesh.indices : mesh.lodIndices.back();
+            float lodError;
+            vector<unsigned int> lod = MeshSimplifier::simplify(mesh.vertices, previous, previous.size() / 2, maxError, &lodError);
+            if (lod.empty() || lod.size() > previous.size() * 3 / 4)
+                break;
+            MeshOptimizer::optimizeVertexCache(lod, mesh.vertices.size());
+            error += lodError;
+            mesh.lodIndices.push_back(std::move(lod));
+            mesh.lodErrors.push_back(error);
+        }
+    }
+
+    // gets the texture arrays of the model once its textures have all been loaded (see MaterialTable), and adds
+    // the material of every vertex to the vertex array, as the integer attribute 5. If the textures can't be packed
+    // the model keeps drawing one batch at a time
+    void buildMaterialTable()
+    {
+        vector<vector<Texture>> materials;
+        // the files of the textures of every material, models with the same key share their table
+        string key;
+        bool anyTexture = false;
+        for (unsigned int b = 0; b < batches.size(); b++)
+        {
+            for (unsigned int t = 0; t < batches[b].textures.size(); t++)
+            {
+                anyTexture = true;
+                // try again next frame
+                if (!TextureCache::instance().isLoaded(batches[b].textures[t].id))
+                    return;
+                key += batches[b].textures[t].type + ':' + directory + '/' + batches[b].textures[t].path + ';';
+            }
+            materials.push_back(batches[b].textures);
+            key += '|';
+        }
+        materialTableTried = true;
+        if (!anyTexture || !(materialTable = MaterialTableCache::instance().acquire(key, materials)))
+            return;
+
+        vector<GLint> materialOfVertex(totalVertexCount);
+        for (unsigned int b = 0; b < batches.size(); b++)
+            for (unsigned int i = 0; i < batches[b].baseVertices.size(); i++)
+                std::fill_n(materialOfVertex.begin() + batches[b].baseVertices[i], batches[b].vertexCounts[i], (GLint) b);
+
+        glBindVertexArray(VAO);
+        glGenBuffers(1, &materialVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, materialVBO);
+        glBufferData(GL_ARRAY_BUFFER, materialOfVertex.size() * sizeof(GLint), materialOfVertex.data(), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(5);
+        glVertexAttribIPointer(5, 1, GL_INT, sizeof(GLint), (void*)0);
+        glBindVertexArray(0);
+    }
+
+    // gets all material textures of a given type from the texture cache, which only loads the ones that no model has loaded yet.
     // the required info is returned as a Texture struct.
     vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
     {
@@ -176,33 +539,20 @@ private:
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            Texture texture;
+            texture.id = TextureCache::instance().acquire(str.C_Str(), this->directory, gammaCorrection, TextureCompressor::kindOf(typeName));
+            texture.type = typeName;
+            texture.path = str.C_Str();
+            textures.push_back(texture);
+            textures_loaded.push_back(texture);  // every acquire is released when the model is destroyed
         }
         return textures;
     }
 };
 
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
+// with compress, the texture is block compressed (see TextureCompressor), or loaded from the cache of a previous run
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma, TextureCompressor::Kind kind, bool compress)
 {
     string filename = string(path);
     filename = directory + '/' + filename;
@@ -211,7 +561,34 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
     glGenTextures(1, &textureID);
 
     int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
+    unsigned char *data = nullptr;
+    bool decoded = false;
+    CompressedImage compressed;
+    if (compress && !TextureCompressor::loadCache(filename, kind, compressed))
+    {
+        // the pixels are kept for the uncompressed upload below, in case the image can't be compressed
+        data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
+        decoded = true;
+        if (data)
+        {
+            compressed = TextureCompressor::compress(data, width, height, nrComponents, kind);
+            TextureCompressor::saveCache(filename, kind, compressed);
+        }
+    }
+    if (compressed.format)
+    {
+        stbi_image_free(data);
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        TextureCompressor::upload(compressed, compressed.data.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        return textureID;
+    }
+
+    if (!decoded)
+        data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
     if (data)
     {
         GLenum format;
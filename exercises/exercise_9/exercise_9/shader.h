@@ -8,11 +8,23 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
 
 class Shader
 {
 public:
     unsigned int ID;
+
+    // handle to a uniform variable of type T of this shader (int for samplers), get it once with uniform<T>(name) and
+    // use it with the setter of that type. The location is -1 if the shader has no active uniform with that name,
+    // setting it does nothing (like in GL)
+    template <class T>
+    struct Uniform
+    {
+        GLint location = -1;
+    };
+
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
     Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
@@ -95,6 +107,16 @@ public:
         if(geometryPath != nullptr)
             glDeleteShader(geometry);
 
+        cacheUniformLocations();
+    }
+    // returns the handle of a uniform variable, the locations are looked up once, when the program is linked
+    // ------------------------------------------------------------------------
+    template <class T>
+    Uniform<T> uniform(const std::string &name) const
+    {
+        Uniform<T> handle;
+        handle.location = location(name);
+        return handle;
     }
     // activate the shader
     // ------------------------------------------------------------------------
@@ -106,62 +128,114 @@ public:
     // ------------------------------------------------------------------------
     void setBool(const std::string &name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        glUniform1i(location(name), (int)value);
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string &name, int value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1i(location(name), value);
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string &name, float value) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1f(location(name), value);
     }
     // ------------------------------------------------------------------------
     void setVec2(const std::string &name, const glm::vec2 &value) const
     {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform2fv(location(name), 1, &value[0]);
     }
     void setVec2(const std::string &name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+        glUniform2f(location(name), x, y);
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string &name, const glm::vec3 &value) const
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform3fv(location(name), 1, &value[0]);
     }
     void setVec3(const std::string &name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        glUniform3f(location(name), x, y, z);
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string &name, const glm::vec4 &value) const
     {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform4fv(location(name), 1, &value[0]);
     }
     void setVec4(const std::string &name, float x, float y, float z, float w)
     {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+        glUniform4f(location(name), x, y, z, w);
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string &name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string &name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string &name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
+    // the same setters for uniform handles, they don't look anything up and only take a handle of their type
+    // ------------------------------------------------------------------------
+    void setBool(Uniform<bool> u, bool value) const { glUniform1i(u.location, (int)value); }
+    void setInt(Uniform<int> u, int value) const { glUniform1i(u.location, value); }
+    void setFloat(Uniform<float> u, float value) const { glUniform1f(u.location, value); }
+    void setVec2(Uniform<glm::vec2> u, const glm::vec2 &value) const { glUniform2fv(u.location, 1, &value[0]); }
+    void setVec3(Uniform<glm::vec3> u, const glm::vec3 &value) const { glUniform3fv(u.location, 1, &value[0]); }
+    void setVec4(Uniform<glm::vec4> u, const glm::vec4 &value) const { glUniform4fv(u.location, 1, &value[0]); }
+    void setIVec4Array(Uniform<glm::ivec4> u, const GLint *values, GLsizei count) const { glUniform4iv(u.location, count, values); }
+    void setMat3(Uniform<glm::mat3> u, const glm::mat3 &mat) const { glUniformMatrix3fv(u.location, 1, GL_FALSE, &mat[0][0]); }
+    void setMat4(Uniform<glm::mat4> u, const glm::mat4 &mat) const { glUniformMatrix4fv(u.location, 1, GL_FALSE, &mat[0][0]); }
 
 private:
+    std::unordered_map<std::string, GLint> uniformLocations;
+
+    // location of a uniform variable, -1 if the shader doesn't have it
+    // ------------------------------------------------------------------------
+    GLint location(const std::string &name) const
+    {
+        auto it = uniformLocations.find(name);
+        if (it != uniformLocations.end())
+            return it->second;
+        // elements of arrays other than the first one are not in the table
+        if (name.find('[') != std::string::npos)
+            return glGetUniformLocation(ID, name.c_str());
+        return -1;
+    }
+
+    // stores the location of every active uniform of the program, arrays are stored both as "name" and "name[0]"
+    // ------------------------------------------------------------------------
+    void cacheUniformLocations()
+    {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> name(maxLength + 1);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type;
+            glGetActiveUniform(ID, i, (GLsizei)name.size(), &length, &size, &type, name.data());
+            std::string uniformName(name.data(), length);
+            GLint location = glGetUniformLocation(ID, uniformName.c_str());
+            // uniforms in a uniform block don't have a location
+            if (location < 0)
+                continue;
+            uniformLocations[uniformName] = location;
+            size_t bracket = uniformName.find('[');
+            if (bracket != std::string::npos)
+                uniformLocations[uniformName.substr(0, bracket)] = location;
+        }
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
@@ -5,6 +5,7 @@ in VS_OUT {
    vec3 N_eye;
    vec3 Light_eye;
    vec2 textCoord;
+   flat int materialIndex;
 } fs_in;
 
 // light uniform variables
@@ -25,6 +26,41 @@ uniform sampler2D texture_diffuse1;
 uniform sampler2D texture_normal1;
 uniform sampler2D texture_ambient1;
 
+// the same textures, when the model has packed them in texture arrays (see MaterialTable)
+uniform bool useMaterialTable;
+uniform sampler2DArray texture_diffuse_array;
+uniform sampler2DArray texture_specular_array;
+uniform sampler2DArray texture_normal_array;
+uniform sampler2DArray texture_ambient_array;
+// layer of the diffuse, specular, normal and ambient texture of each material, -1 if the material doesn't have it
+uniform ivec4 materialLayers[64];
+
+// normal maps compressed to BC5 only have x and y (see TextureCompressor) and read 0 as z, which a normal map
+// never has (z >= 0 is stored as >= 0.5), z is rebuilt from x and y
+vec4 rebuildNormal(vec4 n)
+{
+   if (n.z == 0.0)
+   {
+      vec2 xy = n.xy * 2.0 - 1.0;
+      n.z = 0.5 + 0.5 * sqrt(max(1.0 - dot(xy, xy), 0.0));
+   }
+   return n;
+}
+
+// samples texture 'slot' (0 diffuse, 1 specular, 2 normal, 3 ambient) of the material of the fragment
+vec4 materialTexture(int slot, sampler2D tex, vec2 uv)
+{
+   if (!useMaterialTable)
+      return slot == 2 ? rebuildNormal(texture(tex, uv)) : texture(tex, uv);
+   int layer = materialLayers[fs_in.materialIndex][slot];
+   if (layer < 0)
+      return vec4(1.0);
+   if (slot == 0) return texture(texture_diffuse_array, vec3(uv, layer));
+   if (slot == 1) return texture(texture_specular_array, vec3(uv, layer));
+   if (slot == 2) return rebuildNormal(texture(texture_normal_array, vec3(uv, layer)));
+   return texture(texture_ambient_array, vec3(uv, layer));
+}
+
 uniform float blinn;
 
 // output color
@@ -35,14 +71,14 @@ void main()
 {
 
    // TODO Exercise 9.3 sample texture_diffuse1 color and use it for ambient and diffuse light computation, read it as a vec4
-   vec4 albedo = texture(texture_normal1, fs_in.textCoord); // white, replace this
+   vec4 albedo = materialTexture(2, texture_normal1, fs_in.textCoord); // white, replace this
    vec3 color = albedo.rgb;
    // TODO Exercise 9.5 instead of using the texture above, sample texture_normal1 for ambient and diffuse light computation
    //  (this will be the topic of our next class)
 
 
    // TODO Exercise 9.4 sample texture_ambient1 and use component r to modulate light intensity
-   vec4 ao = texture(texture_ambient1, fs_in.textCoord);
+   vec4 ao = materialTexture(3, texture_ambient1, fs_in.textCoord);
 
    // TODO Exercise 9.4 interpolate between '1.0' and 'ambientOcclusion' using the 'ambientOcclusionMix' parameter and the 'mix' function
 
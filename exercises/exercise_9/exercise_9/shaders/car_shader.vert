@@ -1,15 +1,17 @@
 #version 330 core
-layout (location = 0) in vec3 vertex;
+layout (location = 0) in vec4 vertex; // w is the sign of the bitangent when the vertices are packed
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 textCoord;
 layout (location = 3) in vec3 tangent;
 layout (location = 4) in vec3 bitangent;
+layout (location = 5) in int materialIndex; // row of materialLayers, see MaterialTable
 
 out VS_OUT {
    vec3 Pos_eye;
    vec3 N_eye;
    vec3 Light_eye;
    vec2 textCoord;
+   flat int materialIndex;
 } vs_out;
 
 // transformations
@@ -21,12 +23,35 @@ uniform mat4 invTranspMV; // inverse of the transpose of (view * model) (used to
 // light uniform variables
 uniform vec3 lightPosition;
 
+// vertices packed by the Model (see PackedVertex in mesh.h): positions relative to a box, octahedral normal and tangent
+uniform bool packedVertices;
+uniform vec3 positionCenter;
+uniform vec3 positionHalfSize;
+
+// unit vector from its octahedral encoding (see Mesh::octahedralEncode)
+vec3 unpackDirection(vec2 e)
+{
+   vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+   if (v.z < 0.0)
+      v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+   return normalize(v);
+}
+
 
 void main() {
+   vec3 P = vertex.xyz, N = normal, T = tangent, B = bitangent;
+   if (packedVertices)
+   {
+      P = positionCenter + vertex.xyz * positionHalfSize;
+      N = unpackDirection(normal.xy);
+      T = unpackDirection(tangent.xy);
+      B = cross(N, T) * vertex.w;
+   }
+
    // vertex in eye space (for light computation in eye space)
-   vec4 Pos_eye = view * model * vec4(vertex, 1.0);
+   vec4 Pos_eye = view * model * vec4(P, 1.0);
    // normal in eye space (for light computation in eye space)
-   vec3 N_eye = normalize((invTranspMV * vec4(normal, 0.0)).xyz);
+   vec3 N_eye = normalize((invTranspMV * vec4(N, 0.0)).xyz);
    // light in eye space
    vec4 Light_eye = view * vec4(lightPosition, 1.0);
 
@@ -38,4 +63,5 @@ void main() {
    vs_out.N_eye = N_eye;
    vs_out.Light_eye = Light_eye.xyz;
    vs_out.textCoord = textCoord;
+   vs_out.materialIndex = materialIndex;
 }
\ No newline at end of file
@@ -0,0 +1,132 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <glad/glad.h>
+
+#include <texture_loader.h>
+#include <texture_compressor.h>
+
+#include <string>
+#include <unordered_map>
+#include <iostream>
+#include <memory>
+#include <stdlib.h>
+#include <limits.h>
+using namespace std;
+
+// defined in model.h
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma, TextureCompressor::Kind kind, bool compress);
+
+// Textures shared by all the models of the program. Several models often use the same texture files (e.g. the parts
+// of the car all come from the same directory), the cache makes sure every file is only decoded and uploaded once.
+// Textures are identified by the canonical absolute path of their file, so different relative paths to the same file
+// share the texture. Every acquire must be matched by a release, the GL texture is deleted when the last user
+// releases it (this must happen while the GL context still exists)
+//
+// with asyncLoading, the files are decoded in the background (see TextureLoader) and the textures show a white
+// 1x1 placeholder until update() uploads them, so models can be drawn as soon as their meshes are loaded
+//
+// with compressTextures, the textures are block compressed according to their kind (see TextureCompressor), and the
+// compressed images are cached next to the image files
+class TextureCache
+{
+public:
+    bool asyncLoading = true;
+    bool compressTextures = true;
+
+    static TextureCache& instance()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // returns the GL texture of file 'path' (relative to 'directory'), loading it if no one is using it yet
+    unsigned int acquire(const string &path, const string &directory, bool gamma = false,
+                         TextureCompressor::Kind kind = TextureCompressor::Color)
+    {
+        string key = canonicalPath(directory + '/' + path);
+        auto it = textures.find(key);
+        if (it == textures.end())
+        {
+            Entry entry;
+            bool compress = compressTextures && TextureCompressor::isSupported(kind);
+            if (asyncLoading)
+            {
+                static const unsigned char white[4] = {255, 255, 255, 255};
+                if (!loader)
+                    loader.reset(new TextureLoader());
+                entry.id = loader->load(directory + '/' + path, white, kind, compress);
+            }
+            else
+                entry.id = TextureFromFile(path.c_str(), directory, gamma, kind, compress);
+            it = textures.insert(make_pair(key, entry)).first;
+            keys[entry.id] = key;
+        }
+        it->second.users++;
+        return it->second.id;
+    }
+
+    void release(unsigned int id)
+    {
+        auto key = keys.find(id);
+        if (key == keys.end())
+            return;
+        auto it = textures.find(key->second);
+        if (--it->second.users == 0)
+        {
+            if (loader)
+                loader->cancel(id);
+            glDeleteTextures(1, &id);
+            textures.erase(it);
+            keys.erase(key);
+        }
+    }
+
+    // uploads the textures that finished decoding in the background, call it once per frame from the GL thread
+    void update()
+    {
+        if (loader)
+            loader->update();
+    }
+
+    // number of different textures currently loaded
+    size_t size() const { return textures.size(); }
+
+    // number of textures that are still being decoded
+    size_t pendingCount() const { return loader ? loader->pendingCount() : 0; }
+
+    // false while the texture shows its placeholder
+    bool isLoaded(unsigned int id) const { return !loader || !loader->isPending(id); }
+
+private:
+    struct Entry
+    {
+        unsigned int id = 0;
+        unsigned int users = 0;
+    };
+
+    unordered_map<string, Entry> textures;  // by canonical path
+    unordered_map<unsigned int, string> keys; // canonical path of each texture, to release by id
+    unique_ptr<TextureLoader> loader;         // created the first time a texture is loaded asynchronously
+
+    TextureCache() = default;
+    TextureCache(const TextureCache&) = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+
+    // absolute path without '.', '..' or symbolic links, the path as it is if the file doesn't exist
+    static string canonicalPath(const string &path)
+    {
+#ifdef _WIN32
+        char buffer[_MAX_PATH];
+        if (_fullpath(buffer, path.c_str(), _MAX_PATH))
+            return string(buffer);
+#else
+        char buffer[PATH_MAX];
+        if (realpath(path.c_str(), buffer))
+            return string(buffer);
+#endif
+        return path;
+    }
+};
+
+#endif
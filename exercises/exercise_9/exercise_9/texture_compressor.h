@@ -0,0 +1,627 @@
+#ifndef TEXTURE_COMPRESSOR_H
+#define TEXTURE_COMPRESSOR_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <cfloat>
+#include <sys/stat.h>
+using namespace std;
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTURE_COMPRESSOR_SSE
+#endif
+
+// S3TC is an extension (available on every desktop GPU), RGTC is core since OpenGL 3.0
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// a texture compressed by TextureCompressor, all its mip levels one after the other
+struct CompressedImage
+{
+    GLenum format = 0;              // 0 if there is no image
+    int width = 0, height = 0;      // of level 0
+    vector<size_t> levelOffsets;    // of each level in data
+    vector<unsigned char> data;
+
+    unsigned int levelCount() const { return levelOffsets.size(); }
+    size_t levelSize(unsigned int level) const
+    {
+        return (level + 1 < levelOffsets.size() ? levelOffsets[level + 1] : data.size()) - levelOffsets[level];
+    }
+};
+
+// Compresses textures to the block formats GPUs sample directly, which take 4 to 8 times less memory than RGBA8
+// (and less bandwidth to sample):
+//  - BC1 (DXT1) for opaque color, 4 bits per texel
+//  - BC3 (DXT5) for color with alpha, 8 bits per texel
+//  - BC4 (RGTC1) for single channel masks like ambient occlusion, 4 bits per texel, read as (r, 0, 0, 1)
+//  - BC5 (RGTC2) for normal maps, 8 bits per texel, read as (x, y, 0, 1), the shader rebuilds z
+// Every block of 4x4 texels is stored as two endpoints and the position of each texel between them.
+//
+// Compressing is slow, so the result, with all its mip levels, is saved next to the image file (see cachePath) and
+// loaded from there as long as the image file doesn't change.
+class TextureCompressor
+{
+public:
+    enum Kind { Color = 0, NormalMap = 1, Mask = 2 };
+
+    // the kind of the textures of each type of material texture
+    static Kind kindOf(const string &typeName)
+    {
+        if (typeName == "texture_normal")
+            return NormalMap;
+        if (typeName == "texture_ambient")
+            return Mask;
+        return Color;
+    }
+
+    // whether the GPU can sample the formats used for 'kind', call it from the GL thread
+    static bool isSupported(Kind kind)
+    {
+        if (kind != Color)
+            return true;
+        static int s3tc = -1;
+        if (s3tc < 0)
+        {
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &count);
+            vector<GLint> formats(max(count, 0));
+            if (count > 0)
+                glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, formats.data());
+            s3tc = std::find(formats.begin(), formats.end(), GL_COMPRESSED_RGB_S3TC_DXT1_EXT) != formats.end() &&
+                   std::find(formats.begin(), formats.end(), GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) != formats.end();
+        }
+        return s3tc == 1;
+    }
+
+    // compresses the image and its mip levels, 'pixels' has 'components' bytes per texel (as given by stbi_load)
+    static CompressedImage compress(const unsigned char *pixels, int width, int height, int components, Kind kind)
+    {
+        vector<unsigned char> rgba = toRGBA(pixels, width, height, components);
+        CompressedImage image;
+        image.width = width;
+        image.height = height;
+        if (kind == NormalMap)
+            image.format = GL_COMPRESSED_RG_RGTC2;
+        else if (kind == Mask)
+            image.format = GL_COMPRESSED_RED_RGTC1;
+        else
+        {
+            image.format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+            for (size_t i = 3; i < rgba.size(); i += 4)
+                if (rgba[i] != 255)
+                {
+                    image.format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+                    break;
+                }
+        }
+
+        while (true)
+        {
+            image.levelOffsets.push_back(image.data.size());
+            compressLevel(rgba, width, height, image.format, image.data);
+            if (width == 1 && height == 1)
+                break;
+            rgba = halfSize(rgba, width, height, kind == NormalMap);
+            width = max(1, width / 2);
+            height = max(1, height / 2);
+        }
+        return image;
+    }
+
+    // creates the levels of the bound GL_TEXTURE_2D. 'pixels' is image.data, or the offset of a copy of it in the
+    // bound pixel unpack buffer
+    static void upload(const CompressedImage &image, const unsigned char *pixels)
+    {
+        for (unsigned int level = 0; level < image.levelCount(); level++)
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, image.format, max(1, image.width >> level), max(1, image.height >> level),
+                                   0, image.levelSize(level), pixels + image.levelOffsets[level]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.levelCount() - 1);
+    }
+
+    static string cachePath(const string &imagePath)
+    {
+        return imagePath + ".bctex";
+    }
+
+    // loads the compressed version of the image file, returns false if there is none or it's out of date
+    static bool loadCache(const string &imagePath, Kind kind, CompressedImage &image)
+    {
+        uint64_t hash = sourceHash(imagePath);
+        if (hash == 0)
+            return false;
+        FILE *in = fopen(cachePath(imagePath).c_str(), "rb");
+        if (!in)
+            return false;
+        CacheHeader header;
+        bool valid = fread(&header, sizeof(header), 1, in) == 1 && memcmp(header.magic, "BCTX", 4) == 0 &&
+                     header.version == cacheVersion && header.sourceHash == hash && header.kind == uint32_t(kind) &&
+                     header.width > 0 && header.height > 0 && header.width <= 65536 && header.height <= 65536 &&
+                     (header.format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || header.format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ||
+                      header.format == GL_COMPRESSED_RED_RGTC1 || header.format == GL_COMPRESSED_RG_RGTC2);
+        if (valid)
+        {
+            // the sizes of the levels follow from the size of the image
+            image.format = header.format;
+            image.width = header.width;
+            image.height = header.height;
+            image.levelOffsets.clear();
+            size_t size = 0;
+            for (int w = header.width, h = header.height; ; w = max(1, w / 2), h = max(1, h / 2))
+            {
+                image.levelOffsets.push_back(size);
+                size += levelSize(header.format, w, h);
+                if (w == 1 && h == 1)
+                    break;
+            }
+            image.data.resize(size);
+            valid = fread(image.data.data(), 1, size, in) == size && fgetc(in) == EOF;
+        }
+        fclose(in);
+        if (!valid)
+            image = CompressedImage();
+        return valid;
+    }
+
+    static bool saveCache(const string &imagePath, Kind kind, const CompressedImage &image)
+    {
+        CacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "BCTX", 4);
+        header.version = cacheVersion;
+        header.sourceHash = sourceHash(imagePath);
+        header.format = image.format;
+        header.kind = kind;
+        header.width = image.width;
+        header.height = image.height;
+        if (header.sourceHash == 0)
+            return false;
+
+        // we write to a temporary file and rename it, so that a program loading the cache never sees a half written file
+        string name = cachePath(imagePath), tempName = name + ".tmp";
+        FILE *out = fopen(tempName.c_str(), "wb");
+        if (!out)
+            return false;
+        bool written = fwrite(&header, sizeof(header), 1, out) == 1 &&
+                       fwrite(image.data.data(), 1, image.data.size(), out) == image.data.size();
+        written = fclose(out) == 0 && written;
+        // rename doesn't replace existing files on every platform
+        remove(name.c_str());
+        if (!written || rename(tempName.c_str(), name.c_str()) != 0)
+        {
+            remove(tempName.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // 8 bytes: two RGB565 endpoints (the first one greater, 4 color mode) and 2 bits per texel
+    static void compressBC1(const unsigned char rgba[64], unsigned char out[8])
+    {
+        BlockColors colors;
+        for (unsigned int i = 0; i < 16; i++)
+        {
+            colors.r[i] = rgba[i * 4];
+            colors.g[i] = rgba[i * 4 + 1];
+            colors.b[i] = rgba[i * 4 + 2];
+        }
+
+        // the endpoints are the extremes of the colors along their principal axis (power iteration on the
+        // covariance matrix), moved inwards a little since the extremes are rarely worth an exact match
+        glm::vec3 mean;
+        float cov[6];
+        covariance(colors, mean, cov);
+        glm::vec3 axis(1.0f);
+        for (unsigned int iteration = 0; iteration < 8; iteration++)
+        {
+            axis = glm::vec3(cov[0] * axis.x + cov[1] * axis.y + cov[2] * axis.z,
+                             cov[1] * axis.x + cov[3] * axis.y + cov[4] * axis.z,
+                             cov[2] * axis.x + cov[4] * axis.y + cov[5] * axis.z);
+            float length = max(abs(axis.x), max(abs(axis.y), abs(axis.z)));
+            if (length == 0.0f)
+                break;
+            axis /= length;
+        }
+        float minT, maxT;
+        projectionRange(colors, mean, axis, minT, maxT);
+        glm::vec3 end0 = mean + axis * maxT, end1 = mean + axis * minT;
+        glm::vec3 inset = (end0 - end1) / 16.0f;
+
+        unsigned short color0, color1;
+        unsigned int bits;
+        float error = fitBC1(colors, end0 - inset, end1 + inset, color0, color1, bits);
+
+        // least squares endpoints for the positions the texels got, kept if they are better
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        glm::vec3 ax(0.0f), bx(0.0f);
+        static const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+        for (unsigned int i = 0; i < 16; i++)
+        {
+            float a = weights[(bits >> (i * 2)) & 3], b = 1.0f - a;
+            aa += a * a; ab += a * b; bb += b * b;
+            glm::vec3 color(colors.r[i], colors.g[i], colors.b[i]);
+            ax += color * a;
+            bx += color * b;
+        }
+        float det = aa * bb - ab * ab;
+        if (abs(det) > 1e-6f)
+        {
+            unsigned short refit0, refit1;
+            unsigned int refitBits;
+            float refitError = fitBC1(colors, (ax * bb - bx * ab) / det, (bx * aa - ax * ab) / det, refit0, refit1, refitBits);
+            if (refitError < error)
+            {
+                color0 = refit0;
+                color1 = refit1;
+                bits = refitBits;
+            }
+        }
+
+        out[0] = color0 & 0xFF; out[1] = color0 >> 8;
+        out[2] = color1 & 0xFF; out[3] = color1 >> 8;
+        for (unsigned int i = 0; i < 4; i++)
+            out[4 + i] = (bits >> (i * 8)) & 0xFF;
+    }
+
+    // 8 bytes: two 8 bit endpoints (the first one greater, 8 value mode) and 3 bits per texel
+    static void compressBC4(const unsigned char values[16], unsigned char out[8])
+    {
+        unsigned char lo = 255, hi = 0;
+        for (unsigned int i = 0; i < 16; i++)
+        {
+            lo = min(lo, values[i]);
+            hi = max(hi, values[i]);
+        }
+        out[0] = hi;
+        out[1] = lo;
+        uint64_t bits = 0;
+        if (hi > lo)
+        {
+            for (unsigned int i = 0; i < 16; i++)
+            {
+                // steps from hi (index 0) to lo (index 1), the 6 values between them are the indices 2 to 7
+                unsigned int step = (unsigned int) ((hi - values[i]) * 7.0f / (hi - lo) + 0.5f);
+                uint64_t index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+                bits |= index << (i * 3);
+            }
+        }
+        for (unsigned int i = 0; i < 6; i++)
+            out[2 + i] = (bits >> (i * 8)) & 0xFF;
+    }
+
+    // bytes of a level of the given size
+    static size_t levelSize(GLenum format, int width, int height)
+    {
+        size_t blockSize = format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RED_RGTC1 ? 8 : 16;
+        return size_t((width + 3) / 4) * ((height + 3) / 4) * blockSize;
+    }
+
+private:
+    static const uint32_t cacheVersion = 1;
+
+    struct CacheHeader
+    {
+        char magic[4];          // "BCTX"
+        uint32_t version;
+        uint64_t sourceHash;    // see sourceHash
+        uint32_t format;        // GL_COMPRESSED_...
+        uint32_t kind;
+        uint32_t width, height; // of level 0, the levels follow down to 1x1
+    };
+
+    // identifies the contents of the image file: hash of its size and modification time, 0 if it doesn't exist
+    static uint64_t sourceHash(const string &path)
+    {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            return 0;
+        uint64_t words[2] = {uint64_t(st.st_size), uint64_t(st.st_mtime)};
+        uint64_t hash = 14695981039346656037ull;
+        for (uint64_t word : words)
+            for (unsigned int byte = 0; byte < 8; byte++)
+                hash = (hash ^ ((word >> (byte * 8)) & 0xFF)) * 1099511628211ull;
+        return hash == 0 ? 1 : hash;
+    }
+
+    static vector<unsigned char> toRGBA(const unsigned char *pixels, int width, int height, int components)
+    {
+        vector<unsigned char> rgba(size_t(width) * height * 4);
+        for (size_t i = 0; i < size_t(width) * height; i++)
+        {
+            const unsigned char *in = pixels + i * components;
+            unsigned char *out = &rgba[i * 4];
+            if (components < 3)
+                out[0] = out[1] = out[2] = in[0];
+            else
+            {
+                out[0] = in[0];
+                out[1] = in[1];
+                out[2] = in[2];
+            }
+            out[3] = components == 2 ? in[1] : components == 4 ? in[3] : 255;
+        }
+        return rgba;
+    }
+
+    // 2x2 box filter, the normals of normal maps are normalized again
+    static vector<unsigned char> halfSize(const vector<unsigned char> &rgba, int width, int height, bool normalMap)
+    {
+        int halfWidth = max(1, width / 2), halfHeight = max(1, height / 2);
+        vector<unsigned char> half(size_t(halfWidth) * halfHeight * 4);
+        for (int y = 0; y < halfHeight; y++)
+        {
+            for (int x = 0; x < halfWidth; x++)
+            {
+                int x0 = min(x * 2, width - 1), x1 = min(x * 2 + 1, width - 1);
+                int y0 = min(y * 2, height - 1), y1 = min(y * 2 + 1, height - 1);
+                float sum[4];
+                for (int c = 0; c < 4; c++)
+                    sum[c] = (rgba[(size_t(y0) * width + x0) * 4 + c] + rgba[(size_t(y0) * width + x1) * 4 + c] +
+                              rgba[(size_t(y1) * width + x0) * 4 + c] + rgba[(size_t(y1) * width + x1) * 4 + c]) / 4.0f;
+                if (normalMap)
+                {
+                    glm::vec3 n = glm::vec3(sum[0], sum[1], sum[2]) / 127.5f - glm::vec3(1.0f);
+                    if (glm::length(n) > 0.0f)
+                        n = (glm::normalize(n) + glm::vec3(1.0f)) * 127.5f;
+                    else
+                        n = glm::vec3(127.5f, 127.5f, 255.0f);
+                    sum[0] = n.x; sum[1] = n.y; sum[2] = n.z;
+                }
+                for (int c = 0; c < 4; c++)
+                    half[(size_t(y) * halfWidth + x) * 4 + c] = (unsigned char) min(255.0f, sum[c] + 0.5f);
+            }
+        }
+        return half;
+    }
+
+    static void compressLevel(const vector<unsigned char> &rgba, int width, int height, GLenum format, vector<unsigned char> &out)
+    {
+        size_t offset = out.size();
+        out.resize(offset + levelSize(format, width, height));
+        unsigned char *block = &out[offset];
+        unsigned char texels[64], channel[16];
+        for (int by = 0; by < height; by += 4)
+        {
+            for (int bx = 0; bx < width; bx += 4)
+            {
+                // the texels of the blocks on the right and bottom borders that are outside the image repeat the last ones
+                for (int i = 0; i < 16; i++)
+                {
+                    int x = min(bx + i % 4, width - 1), y = min(by + i / 4, height - 1);
+                    memcpy(&texels[i * 4], &rgba[(size_t(y) * width + x) * 4], 4);
+                }
+                if (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+                {
+                    compressBC1(texels, block);
+                    block += 8;
+                }
+                else if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+                {
+                    compressBC4(extractChannel(texels, 3, channel), block);
+                    compressBC1(texels, block + 8);
+                    block += 16;
+                }
+                else if (format == GL_COMPRESSED_RED_RGTC1)
+                {
+                    compressBC4(extractChannel(texels, 0, channel), block);
+                    block += 8;
+                }
+                else
+                {
+                    compressBC4(extractChannel(texels, 0, channel), block);
+                    compressBC4(extractChannel(texels, 1, channel), block + 8);
+                    block += 16;
+                }
+            }
+        }
+    }
+
+    static const unsigned char *extractChannel(const unsigned char texels[64], unsigned int c, unsigned char channel[16])
+    {
+        for (unsigned int i = 0; i < 16; i++)
+            channel[i] = texels[i * 4 + c];
+        return channel;
+    }
+
+    static unsigned short to565(const glm::vec3 &color)
+    {
+        glm::vec3 c = glm::clamp(color, glm::vec3(0.0f), glm::vec3(255.0f));
+        return (unsigned short) (((unsigned int) (c.x * 31.0f / 255.0f + 0.5f) << 11) |
+                                 ((unsigned int) (c.y * 63.0f / 255.0f + 0.5f) << 5) |
+                                  (unsigned int) (c.z * 31.0f / 255.0f + 0.5f));
+    }
+
+    static glm::vec3 from565(unsigned short c)
+    {
+        unsigned int r = c >> 11, g = (c >> 5) & 63, b = c & 31;
+        return glm::vec3((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+    }
+
+    // the colors of a block, one array per channel so that the SSE versions of the loops process 4 texels at a time
+    struct BlockColors
+    {
+        alignas(16) float r[16];
+        alignas(16) float g[16];
+        alignas(16) float b[16];
+    };
+
+#ifdef TEXTURE_COMPRESSOR_SSE
+    static float horizontalSum(__m128 v)
+    {
+        v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        return _mm_cvtss_f32(_mm_add_ss(v, _mm_shuffle_ps(v, v, 1)));
+    }
+
+    static float horizontalMin(__m128 v)
+    {
+        v = _mm_min_ps(v, _mm_movehl_ps(v, v));
+        return _mm_cvtss_f32(_mm_min_ss(v, _mm_shuffle_ps(v, v, 1)));
+    }
+
+    static float horizontalMax(__m128 v)
+    {
+        v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+        return _mm_cvtss_f32(_mm_max_ss(v, _mm_shuffle_ps(v, v, 1)));
+    }
+#endif
+
+    // mean of the colors, and their covariance matrix (xx, xy, xz, yy, yz, zz)
+    static void covariance(const BlockColors &colors, glm::vec3 &mean, float cov[6])
+    {
+#ifdef TEXTURE_COMPRESSOR_SSE
+        __m128 sumR = _mm_setzero_ps(), sumG = _mm_setzero_ps(), sumB = _mm_setzero_ps();
+        for (unsigned int i = 0; i < 16; i += 4)
+        {
+            sumR = _mm_add_ps(sumR, _mm_load_ps(colors.r + i));
+            sumG = _mm_add_ps(sumG, _mm_load_ps(colors.g + i));
+            sumB = _mm_add_ps(sumB, _mm_load_ps(colors.b + i));
+        }
+        mean = glm::vec3(horizontalSum(sumR), horizontalSum(sumG), horizontalSum(sumB)) / 16.0f;
+
+        __m128 meanR = _mm_set1_ps(mean.x), meanG = _mm_set1_ps(mean.y), meanB = _mm_set1_ps(mean.z);
+        __m128 sums[6];
+        for (unsigned int c = 0; c < 6; c++)
+            sums[c] = _mm_setzero_ps();
+        for (unsigned int i = 0; i < 16; i += 4)
+        {
+            __m128 dr = _mm_sub_ps(_mm_load_ps(colors.r + i), meanR);
+            __m128 dg = _mm_sub_ps(_mm_load_ps(colors.g + i), meanG);
+            __m128 db = _mm_sub_ps(_mm_load_ps(colors.b + i), meanB);
+            sums[0] = _mm_add_ps(sums[0], _mm_mul_ps(dr, dr));
+            sums[1] = _mm_add_ps(sums[1], _mm_mul_ps(dr, dg));
+            sums[2] = _mm_add_ps(sums[2], _mm_mul_ps(dr, db));
+            sums[3] = _mm_add_ps(sums[3], _mm_mul_ps(dg, dg));
+            sums[4] = _mm_add_ps(sums[4], _mm_mul_ps(dg, db));
+            sums[5] = _mm_add_ps(sums[5], _mm_mul_ps(db, db));
+        }
+        for (unsigned int c = 0; c < 6; c++)
+            cov[c] = horizontalSum(sums[c]);
+#else
+        mean = glm::vec3(0.0f);
+        for (unsigned int i = 0; i < 16; i++)
+            mean += glm::vec3(colors.r[i], colors.g[i], colors.b[i]);
+        mean /= 16.0f;
+
+        for (unsigned int c = 0; c < 6; c++)
+            cov[c] = 0.0f;
+        for (unsigned int i = 0; i < 16; i++)
+        {
+            glm::vec3 d = glm::vec3(colors.r[i], colors.g[i], colors.b[i]) - mean;
+            cov[0] += d.x * d.x; cov[1] += d.x * d.y; cov[2] += d.x * d.z;
+            cov[3] += d.y * d.y; cov[4] += d.y * d.z; cov[5] += d.z * d.z;
+        }
+#endif
+    }
+
+    // smallest and largest projection of the colors on the axis through the mean, the mean itself included
+    static void projectionRange(const BlockColors &colors, const glm::vec3 &mean, const glm::vec3 &axis, float &minT, float &maxT)
+    {
+#ifdef TEXTURE_COMPRESSOR_SSE
+        __m128 meanR = _mm_set1_ps(mean.x), meanG = _mm_set1_ps(mean.y), meanB = _mm_set1_ps(mean.z);
+        __m128 axisR = _mm_set1_ps(axis.x), axisG = _mm_set1_ps(axis.y), axisB = _mm_set1_ps(axis.z);
+        __m128 lowest = _mm_setzero_ps(), highest = _mm_setzero_ps();
+        for (unsigned int i = 0; i < 16; i += 4)
+        {
+            __m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(colors.r + i), meanR), axisR),
+                                             _mm_mul_ps(_mm_sub_ps(_mm_load_ps(colors.g + i), meanG), axisG)),
+                                  _mm_mul_ps(_mm_sub_ps(_mm_load_ps(colors.b + i), meanB), axisB));
+            lowest = _mm_min_ps(lowest, t);
+            highest = _mm_max_ps(highest, t);
+        }
+        minT = horizontalMin(lowest);
+        maxT = horizontalMax(highest);
+#else
+        minT = 0.0f;
+        maxT = 0.0f;
+        for (unsigned int i = 0; i < 16; i++)
+        {
+            float t = glm::dot(glm::vec3(colors.r[i], colors.g[i], colors.b[i]) - mean, axis);
+            minT = min(minT, t);
+            maxT = max(maxT, t);
+        }
+#endif
+    }
+
+    // quantizes the endpoints and gives every texel the closest of the 4 colors, returns the squared error
+    static float fitBC1(const BlockColors &colors, const glm::vec3 &end0, const glm::vec3 &end1,
+                        unsigned short &color0, unsigned short &color1, unsigned int &bits)
+    {
+        color0 = to565(end0);
+        color1 = to565(end1);
+        // color0 > color1 selects the 4 color mode, with color0 == color1 all the texels use color0
+        if (color0 < color1)
+            std::swap(color0, color1);
+
+        glm::vec3 palette[4];
+        palette[0] = from565(color0);
+        palette[1] = from565(color1);
+        palette[2] = (palette[0] * 2.0f + palette[1]) / 3.0f;
+        palette[3] = (palette[0] + palette[1] * 2.0f) / 3.0f;
+        unsigned int paletteSize = color0 == color1 ? 1 : 4;
+
+        bits = 0;
+#ifdef TEXTURE_COMPRESSOR_SSE
+        // 4 texels at a time, the index of the closest color is selected with the comparison masks
+        __m128 errors = _mm_setzero_ps();
+        for (unsigned int i = 0; i < 16; i += 4)
+        {
+            __m128 r = _mm_load_ps(colors.r + i), g = _mm_load_ps(colors.g + i), b = _mm_load_ps(colors.b + i);
+            __m128 bestDistance = _mm_set1_ps(FLT_MAX);
+            __m128i best = _mm_setzero_si128();
+            for (unsigned int p = 0; p < paletteSize; p++)
+            {
+                __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[p].x));
+                __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[p].y));
+                __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[p].z));
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+                __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, bestDistance));
+                best = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(p)), _mm_andnot_si128(closer, best));
+                bestDistance = _mm_min_ps(distance, bestDistance);
+            }
+            errors = _mm_add_ps(errors, bestDistance);
+            alignas(16) unsigned int indices[4];
+            _mm_store_si128((__m128i*) indices, best);
+            for (unsigned int j = 0; j < 4; j++)
+                bits |= indices[j] << ((i + j) * 2);
+        }
+        return horizontalSum(errors);
+#else
+        float error = 0.0f;
+        for (unsigned int i = 0; i < 16; i++)
+        {
+            glm::vec3 color(colors.r[i], colors.g[i], colors.b[i]);
+            unsigned int best = 0;
+            float bestDistance = FLT_MAX;
+            for (unsigned int p = 0; p < paletteSize; p++)
+            {
+                glm::vec3 d = color - palette[p];
+                float distance = glm::dot(d, d);
+                if (distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+            bits |= best << (i * 2);
+            error += bestDistance;
+        }
+        return error;
+#endif
+    }
+};
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <texture_compressor.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+using namespace std;
+
+// Loads textures in the background. Decoding an image file takes much longer than uploading it, so the files are
+// decoded by a pool of worker threads, and only the upload happens on the thread that owns the GL context.
+//
+// load() creates the GL texture right away with a 1x1 placeholder image, so it can be bound and drawn immediately,
+// and queues the file. update() must be called regularly (once per frame) by the GL thread: it uploads the images
+// that have been decoded since the last call, through a pixel buffer object, and replaces the placeholders.
+//
+// Textures loaded with 'compress' are block compressed by the worker threads the first time, and read already
+// compressed from the cache file of the image afterwards (see TextureCompressor).
+class TextureLoader
+{
+public:
+    // maximum number of bytes uploaded by a call to update (at least one image is always uploaded),
+    // so that a frame doesn't stall when many textures finish decoding at the same time
+    size_t uploadBudget = 32 << 20;
+
+    explicit TextureLoader(unsigned int threadCount = 0)
+    {
+        if (threadCount == 0)
+            // one core is left for the render thread
+            threadCount = max(2u, thread::hardware_concurrency()) - 1;
+        for (unsigned int i = 0; i < threadCount; i++)
+            workers.emplace_back([this]() { decodeLoop(); });
+    }
+
+    ~TextureLoader()
+    {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
+        }
+        jobsChanged.notify_all();
+        for (thread &worker : workers)
+            worker.join();
+        for (Image &image : decoded)
+            stbi_image_free(image.data);
+        // the pixel buffer is not deleted here, the GL context may not exist anymore
+    }
+
+    TextureLoader(const TextureLoader&) = delete;
+    TextureLoader& operator=(const TextureLoader&) = delete;
+
+    // creates a texture with a placeholder image and queues 'filename' to replace it
+    // (compress must only be set if TextureCompressor::isSupported(kind))
+    unsigned int load(const string &filename, const unsigned char placeholder[4],
+                      TextureCompressor::Kind kind = TextureCompressor::Color, bool compress = false)
+    {
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        Job job;
+        job.textureID = textureID;
+        job.ticket = ++lastTicket;
+        job.filename = filename;
+        job.kind = kind;
+        job.compress = compress;
+        // GL can reuse the name of a deleted texture, the ticket tells the images of the current texture from
+        // the images of a texture that had the same name before
+        pending[textureID] = job.ticket;
+        {
+            lock_guard<mutex> lock(queueMutex);
+            jobs.push_back(job);
+        }
+        jobsChanged.notify_one();
+        return textureID;
+    }
+
+    // the texture is about to be deleted, its image (if it is still being decoded) won't be uploaded
+    void cancel(unsigned int textureID)
+    {
+        pending.erase(textureID);
+    }
+
+    // number of textures that are still showing their placeholder
+    size_t pendingCount() const { return pending.size(); }
+    bool isPending(unsigned int textureID) const { return pending.count(textureID) != 0; }
+
+    // uploads the images that are ready, call it from the GL thread
+    void update()
+    {
+        vector<Image> ready;
+        {
+            lock_guard<mutex> lock(queueMutex);
+            size_t bytes = 0;
+            while (!decoded.empty() && (ready.empty() || bytes < uploadBudget))
+            {
+                bytes += decoded.front().size();
+                ready.push_back(std::move(decoded.front()));
+                decoded.pop_front();
+            }
+        }
+
+        for (Image &image : ready)
+        {
+            auto it = pending.find(image.textureID);
+            if (it != pending.end() && it->second == image.ticket)
+            {
+                pending.erase(it);
+                if (image.data || image.compressed.format)
+                    upload(image);
+                else
+                    std::cout << "Texture failed to load at path: " << image.filename << std::endl;
+            }
+            stbi_image_free(image.data);
+        }
+    }
+
+private:
+    struct Job
+    {
+        unsigned int textureID;
+        uint64_t ticket;
+        string filename;
+        TextureCompressor::Kind kind;
+        bool compress;
+    };
+
+    struct Image
+    {
+        unsigned int textureID;
+        uint64_t ticket;
+        string filename;
+        unsigned char *data;    // nullptr if the file could not be decoded, or if the image is compressed
+        int width, height, nrComponents;
+        CompressedImage compressed;
+
+        size_t size() const { return data ? size_t(width) * height * nrComponents : compressed.data.size(); }
+    };
+
+    vector<thread> workers;
+    mutex queueMutex;
+    condition_variable jobsChanged;
+    deque<Job> jobs;
+    deque<Image> decoded;
+    bool stopping = false;
+
+    // only used by the GL thread
+    unordered_map<unsigned int, uint64_t> pending; // ticket of the image each texture is waiting for
+    uint64_t lastTicket = 0;
+    unsigned int pixelBuffer = 0;
+
+    void decodeLoop()
+    {
+        while (true)
+        {
+            Job job;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                jobsChanged.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (stopping)
+                    return;
+                job = jobs.front();
+                jobs.pop_front();
+            }
+
+            Image image;
+            image.textureID = job.textureID;
+            image.ticket = job.ticket;
+            image.filename = job.filename;
+            image.data = nullptr;
+            if (!job.compress || !TextureCompressor::loadCache(job.filename, job.kind, image.compressed))
+            {
+                image.data = stbi_load(job.filename.c_str(), &image.width, &image.height, &image.nrComponents, 0);
+                if (image.data && job.compress)
+                {
+                    image.compressed = TextureCompressor::compress(image.data, image.width, image.height, image.nrComponents, job.kind);
+                    TextureCompressor::saveCache(job.filename, job.kind, image.compressed);
+                    stbi_image_free(image.data);
+                    image.data = nullptr;
+                }
+            }
+
+            lock_guard<mutex> lock(queueMutex);
+            decoded.push_back(std::move(image));
+        }
+    }
+
+    void upload(const Image &image)
+    {
+        GLenum format = GL_RGBA;
+        if (image.nrComponents == 1)
+            format = GL_RED;
+        else if (image.nrComponents == 3)
+            format = GL_RGB;
+        else if (image.nrComponents == 4)
+            format = GL_RGBA;
+
+        // the image is copied to a pixel buffer and the texture is specified from it, so glTexImage2D doesn't
+        // have to wait for the transfer. Allocating new storage for the buffer every time (orphaning) means we never
+        // write to memory the GPU is still reading from a previous upload
+        if (pixelBuffer == 0)
+            glGenBuffers(1, &pixelBuffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, image.size(), NULL, GL_STREAM_DRAW);
+        void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, image.size(), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        const unsigned char *pixels = image.data ? image.data : image.compressed.data.data();
+        if (mapped)
+        {
+            memcpy(mapped, pixels, image.size());
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            pixels = 0; // offset in the pixel buffer
+        }
+        else
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        glBindTexture(GL_TEXTURE_2D, image.textureID);
+        if (image.data)
+        {
+            glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, pixels);
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+        else
+            // the mip levels are in the compressed image
+            TextureCompressor::upload(image.compressed, pixels);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+};
+
+#endif